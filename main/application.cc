@@ -6,11 +6,14 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "latency_tracer.h"
+#include "tls_session_cache.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
 #include "assets/lang_config.h"
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -33,7 +36,8 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
-Application::Application() {
+Application::Application() : audio_decode_queue_(OPUS_MAX_PACKET_SIZE) {
+    audio_decode_packet_.reserve(OPUS_MAX_PACKET_SIZE);
     event_group_ = xEventGroupCreate();
     background_task_ = new BackgroundTask(4096 * 8);
 
@@ -116,10 +120,7 @@ void Application::CheckNewVersion() {
             auto codec = board.GetAudioCodec();
             codec->EnableInput(false);
             codec->EnableOutput(false);
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                audio_decode_queue_.clear();
-            }
+            audio_decode_queue_.Clear();
             background_task_->WaitForCompletion();
             delete background_task_;
             background_task_ = nullptr;
@@ -193,16 +194,18 @@ void Application::ShowActivationCode() {
         digit_sound{'9', Lang::Sounds::P3_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
     Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
 
+    // The digits play right after the sentence without gaps
+    std::vector<std::string_view> sounds;
     for (const auto& digit : code) {
         auto it = std::find_if(digit_sounds.begin(), digit_sounds.end(),
             [digit](const digit_sound& ds) { return ds.digit == digit; });
         if (it != digit_sounds.end()) {
-            PlaySound(it->sound);
+            sounds.push_back(it->sound);
         }
     }
+    PlaySounds(sounds);
 }
 
 void Application::Alert(const char* status, const char* message, const char* emotion, const std::string_view& sound) {
@@ -212,7 +215,13 @@ void Application::Alert(const char* status, const char* message, const char* emo
     display->SetEmotion(emotion);
     display->SetChatMessage("system", message);
     if (!sound.empty()) {
-        ResetDecoder();
+        if (sound_cache_.enabled()) {
+            // The sound is mixed over any speech, there is no need to cut it off
+            Board::GetInstance().GetAudioCodec()->EnableOutput(true);
+        } else {
+            // Streaming the sound needs the decoder
+            ResetDecoder();
+        }
         PlaySound(sound);
     }
 }
@@ -227,32 +236,59 @@ void Application::DismissAlert() {
 }
 
 void Application::PlaySound(const std::string_view& sound) {
-    // Wait for the previous sound to finish
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        audio_decode_cv_.wait(lock, [this]() {
-            return audio_decode_queue_.empty();
-        });
-    }
-    background_task_->WaitForCompletion();
-
-    // The assets are encoded at 16000Hz, 60ms frame duration
-    SetDecodeSampleRate(16000, 60);
-    const char* data = sound.data();
-    size_t size = sound.size();
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
-
-        auto payload_size = ntohs(p3->payload_size);
-        std::vector<uint8_t> opus;
-        opus.resize(payload_size);
-        memcpy(opus.data(), p3->payload, payload_size);
-        p += payload_size;
+    PlaySounds({sound});
+}
 
+void Application::PlaySounds(const std::vector<std::string_view>& sounds, std::function<void()> on_complete) {
+    if (sounds.empty()) {
+        if (on_complete) {
+            Schedule(on_complete);
+        }
+        return;
+    }
+    {
         std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(opus));
+        for (auto& sound : sounds) {
+            playlist_.emplace_back();
+            auto& item = playlist_.back();
+            item.id = ++playlist_item_id_;
+            item.sound = sound;
+        }
+        playlist_.back().on_complete = on_complete;
+        playlist_active_ = true;
     }
+
+    // Decode on the background task, it has the stack for Opus. It runs ahead of the output
+    // jobs for these sounds, so playback starts from PCM whenever the cache can hold it.
+    auto codec = Board::GetInstance().GetAudioCodec();
+    background_task_->Schedule([this, codec]() {
+        while (true) {
+            uint32_t id = 0;
+            std::string_view sound;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& item : playlist_) {
+                    if (!item.prepared) {
+                        id = item.id;
+                        sound = item.sound;
+                        break;
+                    }
+                }
+            }
+            if (id == 0) {
+                break;
+            }
+            auto pcm = sound_cache_.Load(sound, codec->output_sample_rate());
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& item : playlist_) {
+                if (item.id == id) {
+                    item.pcm = pcm;
+                    item.prepared = true;
+                    break;
+                }
+            }
+        }
+    });
 }
 
 void Application::ToggleChatState() {
@@ -268,9 +304,11 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                return;
+            if (!IsAudioChannelWarm()) {
+                SetDeviceState(kDeviceStateConnecting);
+                if (!protocol_->OpenAudioChannel()) {
+                    return;
+                }
             }
 
             SetListeningMode(realtime_chat_enabled_ ? kListeningModeRealtime : kListeningModeAutoStop);
@@ -281,11 +319,97 @@ void Application::ToggleChatState() {
         });
     } else if (device_state_ == kDeviceStateListening) {
         Schedule([this]() {
-            protocol_->CloseAudioChannel();
+            if (CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS > 0) {
+                // Keep the channel for the next conversation, OnClockTimer closes it when unused
+                protocol_->SendStopListening();
+                SetDeviceState(kDeviceStateIdle);
+            } else {
+                protocol_->CloseAudioChannel();
+            }
         });
     }
 }
 
+void Application::PrepareAudioChannel() {
+    if (CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS == 0 || device_state_ != kDeviceStateIdle ||
+        !protocol_ || protocol_->IsAudioChannelOpened()) {
+        return;
+    }
+    auto now = esp_timer_get_time();
+    if (last_warm_up_time_ != 0 && now - last_warm_up_time_ < AUDIO_CHANNEL_WARM_UP_INTERVAL_SECONDS * 1000000LL) {
+        return;
+    }
+    if (warming_up_.exchange(true)) {
+        return;
+    }
+    last_warm_up_time_ = now;
+    xEventGroupClearBits(event_group_, WARM_UP_DONE_EVENT);
+
+    // The handshake takes a few round trips, the main loop keeps running meanwhile
+    auto ret = xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->WarmUpAudioChannel();
+        vTaskDelete(NULL);
+    }, "warm_up", 4096 * 2, this, 3, nullptr);
+    if (ret != pdPASS) {
+        warming_up_ = false;
+        xEventGroupSetBits(event_group_, WARM_UP_DONE_EVENT);
+    }
+}
+
+void Application::WarmUpAudioChannel() {
+    ESP_LOGI(TAG, "Warming up the audio channel");
+    if (protocol_->OpenAudioChannel()) {
+        idle_close_time_ = esp_timer_get_time() + CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS * 1000000LL;
+    }
+    warming_up_ = false;
+    xEventGroupSetBits(event_group_, WARM_UP_DONE_EVENT);
+}
+
+void Application::WaitForWarmUp() {
+    if (warming_up_) {
+        // The user is waiting for this handshake now, starting another one would only be slower
+        xEventGroupWaitBits(event_group_, WARM_UP_DONE_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
+    }
+    SetUpAudioChannel();
+}
+
+bool Application::IsAudioChannelWarm() {
+    if (CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS == 0 || !protocol_) {
+        return false;
+    }
+    WaitForWarmUp();
+    return protocol_->IsAudioChannelOpened();
+}
+
+// Runs inside OpenAudioChannel(), or on the main loop once a warm-up has opened the channel
+void Application::SetUpAudioChannel() {
+    if (!audio_channel_setup_pending_.exchange(false)) {
+        return;
+    }
+    auto& board = Board::GetInstance();
+    auto codec = board.GetAudioCodec();
+    board.SetPowerSaveMode(false);
+    if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
+        ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
+            protocol_->server_sample_rate(), codec->output_sample_rate());
+    }
+    SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->server_frame_duration());
+    jitter_buffer_.Reset(protocol_->server_frame_duration());
+    encoder_controller_.Reset();
+    if (protocol_->uplink_frame_duration() != frame_duration_) {
+        SetUplinkFrameDuration(protocol_->uplink_frame_duration());
+    }
+    audio_uplink_.SetComplexity(encoder_controller_.complexity());
+    audio_uplink_.SetBitrate(encoder_controller_.bitrate());
+    auto& thing_manager = iot::ThingManager::GetInstance();
+    protocol_->SendIotDescriptors();
+    std::string states;
+    if (thing_manager.GetStatesJson(states, false)) {
+        protocol_->SendIotStates(states);
+    }
+}
+
 void Application::StartListening() {
     if (device_state_ == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
@@ -299,6 +423,7 @@ void Application::StartListening() {
     
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
+            WaitForWarmUp();
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
                 if (!protocol_->OpenAudioChannel()) {
@@ -345,24 +470,34 @@ void Application::Start() {
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    // Realtime sessions trade packet rate for latency with shorter frames
+    frame_duration_ = realtime_chat_enabled_ ? OPUS_REALTIME_FRAME_DURATION_MS : OPUS_FRAME_DURATION_MS;
+    ESP_LOGI(TAG, "Opus frame duration: %d ms", frame_duration_.load());
+    opus_encoder_ = std::make_unique<UplinkEncoder>(16000, 1, frame_duration_);
+    // The starting point of every session, the encoder controller adapts it to the CPU load from there
+    int complexity;
     if (realtime_chat_enabled_) {
         ESP_LOGI(TAG, "Realtime chat enabled, setting opus encoder complexity to 0");
-        opus_encoder_->SetComplexity(0);
+        complexity = 0;
     } else if (board.GetBoardType() == "ml307") {
         ESP_LOGI(TAG, "ML307 board detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
+        complexity = 5;
     } else {
         ESP_LOGI(TAG, "WiFi board detected, setting opus encoder complexity to 3");
-        opus_encoder_->SetComplexity(3);
+        complexity = 3;
     }
+    opus_encoder_->SetComplexity(complexity);
+    opus_encoder_->SetBitrate(ENCODER_MAX_BITRATE);
+    encoder_controller_.Initialize(complexity);
 
-    if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
-    }
+    audio_capture_.Configure(codec, 16000);
     codec->Start();
 
+    // Sounds are queued as views into their assets, so the decode queue needs no payload slab
+    if (!audio_decode_queue_.Allocate(AUDIO_DECODE_QUEUE_CAPACITY, true)) {
+        ESP_LOGE(TAG, "Failed to allocate the decode queue, sounds will be silent");
+    }
+
     xTaskCreatePinnedToCore([](void* arg) {
         Application* app = (Application*)arg;
         app->AudioLoop();
@@ -386,30 +521,32 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+    protocol_->SetFrameDuration(frame_duration_);
+    // Things are registered by the board constructor, serialize their descriptors once
+    auto& thing_manager = iot::ThingManager::GetInstance();
+    protocol_->SetIotDescriptors(thing_manager.GetDescriptors(), thing_manager.GetDescriptorsHash());
 
     protocol_->OnNetworkError([this](const std::string& message) {
+        if (warming_up_) {
+            // Nobody is waiting for the channel yet, do not alert
+            ESP_LOGW(TAG, "Failed to warm up the audio channel: %s", message.c_str());
+            return;
+        }
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
-    protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
-        const int max_packets_in_queue = 300 / OPUS_FRAME_DURATION_MS;
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (audio_decode_queue_.size() < max_packets_in_queue) {
-            audio_decode_queue_.emplace_back(std::move(data));
-        }
+    protocol_->OnIncomingAudio([this](uint32_t sequence, uint32_t timestamp, std::vector<uint8_t>&& data) {
+        jitter_buffer_.Put(sequence, data.data(), data.size(), timestamp);
     });
-    protocol_->OnAudioChannelOpened([this, codec, &board]() {
-        board.SetPowerSaveMode(false);
-        if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
-            ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
-                protocol_->server_sample_rate(), codec->output_sample_rate());
-        }
-        SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->server_frame_duration());
-        auto& thing_manager = iot::ThingManager::GetInstance();
-        protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
-        std::string states;
-        if (thing_manager.GetStatesJson(states, false)) {
-            protocol_->SendIotStates(states);
+    protocol_->OnAudioChannelOpened([this]() {
+        audio_channel_setup_pending_ = true;
+        if (warming_up_) {
+            // Opened off the main loop, which sets the session up before it uses the channel
+            Schedule([this]() {
+                SetUpAudioChannel();
+            });
+        } else {
+            SetUpAudioChannel();
         }
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
@@ -420,81 +557,88 @@ void Application::Start() {
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
+    protocol_->OnIncomingJson([this, display](const JsonView& root) {
+        // Fields are read straight from the received text, missing ones read as empty
+        auto type = root.Get("type");
+        if (type.Equals("tts")) {
+            auto state = root.Get("state");
+            if (state.Equals("start")) {
                 Schedule([this]() {
                     aborted_ = false;
+                    tts_drain_deadline_ = 0;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
                 });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
+            } else if (state.Equals("stop")) {
                 Schedule([this]() {
-                    background_task_->WaitForCompletion();
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
+                    // Play out the frames still in the jitter buffer, leaving the speaking state flushes them.
+                    // CheckSpeakingDone() leaves it once they are gone.
+                    jitter_buffer_.Drain();
+                    tts_drain_deadline_ = esp_timer_get_time() + TTS_DRAIN_TIMEOUT_MS * 1000;
+                    CheckSpeakingDone();
                 });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (text != NULL) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
+            } else if (state.Equals("sentence_start")) {
+                auto text = root.Get("text");
+                if (text.IsString()) {
+                    auto message = text.ToString();
+                    ESP_LOGI(TAG, "<< %s", message.c_str());
+                    Schedule([this, display, message = std::move(message)]() {
                         display->SetChatMessage("assistant", message.c_str());
                     });
                 }
             }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (text != NULL) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
+        } else if (type.Equals("stt")) {
+            auto text = root.Get("text");
+            if (text.IsString()) {
+                auto message = text.ToString();
+                ESP_LOGI(TAG, ">> %s", message.c_str());
+                Schedule([this, display, message = std::move(message)]() {
                     display->SetChatMessage("user", message.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (emotion != NULL) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
+        } else if (type.Equals("llm")) {
+            auto emotion = root.Get("emotion");
+            if (emotion.IsString()) {
+                Schedule([this, display, emotion_str = emotion.ToString()]() {
                     display->SetEmotion(emotion_str.c_str());
                 });
             }
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
-            if (commands != NULL) {
+        } else if (type.Equals("iot")) {
+            auto commands = root.Get("commands");
+            if (commands.IsArray()) {
+                // ThingManager takes cJSON, only the commands are parsed into a tree
+                cJSON* tree = commands.ToCjson();
                 auto& thing_manager = iot::ThingManager::GetInstance();
-                for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
-                    auto command = cJSON_GetArrayItem(commands, i);
+                for (int i = 0; i < cJSON_GetArraySize(tree); ++i) {
+                    auto command = cJSON_GetArrayItem(tree, i);
                     thing_manager.Invoke(command);
                 }
+                cJSON_Delete(tree);
             }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (command != NULL) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
+        } else if (type.Equals("system")) {
+            auto command = root.Get("command");
+            if (command.IsString()) {
+                ESP_LOGI(TAG, "System command: %s", command.ToString().c_str());
+                if (command.Equals("reboot")) {
                     // Do a reboot if user requests a OTA update
                     Schedule([this]() {
                         Reboot();
                     });
+                } else if (command.Equals("stats")) {
+                    Schedule([this]() {
+                        protocol_->SendStats("{\"latency\":" + LatencyTracer::GetInstance().GetStatsJson() + "}");
+                    });
                 } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+                    ESP_LOGW(TAG, "Unknown system command: %s", command.ToString().c_str());
                 }
             }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (status != NULL && message != NULL && emotion != NULL) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
+        } else if (type.Equals("alert")) {
+            auto status = root.Get("status");
+            auto message = root.Get("message");
+            auto emotion = root.Get("emotion");
+            if (status.IsString() && message.IsString() && emotion.IsString()) {
+                Alert(status.ToString().c_str(), message.ToString().c_str(), emotion.ToString().c_str(), Lang::Sounds::P3_VIBRATION);
             } else {
                 ESP_LOGW(TAG, "Alert command requires status, message and emotion");
             }
@@ -502,21 +646,34 @@ void Application::Start() {
     });
     bool protocol_started = protocol_->Start();
 
+    // Realtime chat prefers fresh audio, turn based chat prefers not to cut into speech already queued
+    audio_uplink_.SetDropPolicy(realtime_chat_enabled_ ? kUplinkDropOldest : kUplinkDropNewest);
+#if CONFIG_USE_SILENCE_SUPPRESSION
+    // The AFE VAD only runs in turn based chat, elsewhere let Opus DTX find the silence
+#if CONFIG_USE_AUDIO_PROCESSOR
+    bool vad_available = !realtime_chat_enabled_;
+#else
+    bool vad_available = false;
+#endif
+    if (vad_available) {
+        audio_uplink_.SetSilenceMode(kUplinkSilenceVad);
+    } else {
+        opus_dtx_ = true;
+        opus_encoder_->SetDtx(true);
+        audio_uplink_.SetSilenceMode(kUplinkSilenceDtx);
+    }
+#endif
+    audio_uplink_.Start(opus_encoder_.get(), frame_duration_, background_task_, [this](const std::vector<uint8_t>& opus, int64_t capture_time) {
+        protocol_->SendAudio(opus, capture_time / 1000);
+    });
+
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_.Initialize(codec, realtime_chat_enabled_);
-    audio_processor_.OnOutput([this](std::vector<int16_t>&& data) {
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            if (protocol_->IsAudioChannelBusy()) {
-                return;
-            }
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
-            });
-        });
+    audio_processor_.OnOutput([this](std::vector<int16_t>&& data, int64_t capture_time) {
+        audio_uplink_.PushPcm(data.data(), data.size(), capture_time);
     });
     audio_processor_.OnVadStateChange([this](bool speaking) {
+        audio_uplink_.SetVoiceActive(speaking);
         if (device_state_ == kDeviceStateListening) {
             Schedule([this, speaking]() {
                 if (speaking) {
@@ -532,22 +689,43 @@ void Application::Start() {
 #endif
 
 #if CONFIG_USE_WAKE_WORD_DETECT
-    wake_word_detect_.Initialize(codec);
+    wake_word_detect_.Initialize(codec, frame_duration_);
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
         Schedule([this, &wake_word]() {
             if (device_state_ == kDeviceStateIdle) {
                 SetDeviceState(kDeviceStateConnecting);
+                // The encoder task finishes the pre-roll while the channel opens
                 wake_word_detect_.EncodeWakeWordData();
+                // Capture right away so the user does not have to wait for the handshake,
+                // the uplink holds the audio until the server is listening
+                audio_uplink_.Flush();
+                audio_uplink_.Hold();
+#if CONFIG_USE_AUDIO_PROCESSOR
+                audio_processor_.Start();
+#endif
 
-                if (!protocol_ || !protocol_->OpenAudioChannel()) {
+                if (!protocol_ || (!IsAudioChannelWarm() && !protocol_->OpenAudioChannel())) {
+#if CONFIG_USE_AUDIO_PROCESSOR
+                    audio_processor_.Stop();
+#endif
+                    audio_uplink_.Flush();
+                    audio_uplink_.Release();
                     wake_word_detect_.StartDetection();
                     return;
                 }
                 
                 std::vector<uint8_t> opus;
-                // Encode and send the wake word data to the server
+                // Send the wake word data to the server, ahead of the held audio,
+                // unless the server accepted another frame duration than it was encoded with
+                int preroll_frame_duration = wake_word_detect_.GetWakeWordFrameDuration();
+                bool send_preroll = preroll_frame_duration == frame_duration_;
+                if (!send_preroll) {
+                    ESP_LOGW(TAG, "Dropping the wake word pre-roll of %d ms frames", preroll_frame_duration);
+                }
                 while (wake_word_detect_.GetWakeWordOpus(opus)) {
-                    protocol_->SendAudio(opus);
+                    if (send_preroll) {
+                        protocol_->SendAudio(opus);
+                    }
                 }
                 // Set the chat state to wake word detected
                 protocol_->SendWakeWordDetected(wake_word);
@@ -582,6 +760,24 @@ void Application::Start() {
 
 void Application::OnClockTimer() {
     clock_ticks_++;
+    CheckSpeakingDone();
+
+    if (clock_ticks_ % ENCODER_CONTROL_INTERVAL_SECONDS == 0) {
+        Schedule([this]() {
+            UpdateEncoderSettings();
+        });
+    }
+
+    auto idle_close_time = idle_close_time_.load();
+    if (idle_close_time != 0 && esp_timer_get_time() >= idle_close_time && device_state_ == kDeviceStateIdle) {
+        idle_close_time_ = 0;
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateIdle && protocol_ && protocol_->IsAudioChannelOpened()) {
+                ESP_LOGI(TAG, "Closing the idle audio channel");
+                protocol_->CloseAudioChannel();
+            }
+        });
+    }
 
     // Print the debug info every 10 seconds
     if (clock_ticks_ % 10 == 0) {
@@ -591,6 +787,24 @@ void Application::OnClockTimer() {
         int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
         ESP_LOGI(TAG, "Free internal: %u minimal internal: %u", free_sram, min_free_sram);
 
+        auto stats = jitter_buffer_.GetStats();
+        if (stats.received > 0) {
+            ESP_LOGI(TAG, "Jitter buffer: received %lu played %lu lost %lu late %lu duplicate %lu overflow %lu underrun %lu jitter %lu us depth %lu",
+                stats.received, stats.played, stats.lost, stats.late, stats.duplicate, stats.overflow, stats.underrun,
+                stats.jitter_us, stats.target_depth);
+        }
+        auto uplink_stats = audio_uplink_.GetStats();
+        if (uplink_stats.pcm_frames > 0) {
+            ESP_LOGI(TAG, "Uplink: pcm %lu dropped %lu opus %lu dropped %lu sent %lu suppressed %lu",
+                uplink_stats.pcm_frames, uplink_stats.pcm_dropped, uplink_stats.opus_packets,
+                uplink_stats.opus_dropped, uplink_stats.sent, uplink_stats.suppressed);
+        }
+        LatencyTracer::GetInstance().PrintStats();
+        TlsSessionCache::GetInstance().PrintStats();
+        if (protocol_) {
+            protocol_->PrintStats();
+        }
+
         // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
         if (ota_.HasServerTime()) {
             if (device_state_ == kDeviceStateIdle) {
@@ -606,6 +820,46 @@ void Application::OnClockTimer() {
     }
 }
 
+void Application::UpdateEncoderSettings() {
+    auto stats = audio_uplink_.GetStats();
+    EncoderSignals signals;
+    signals.frame_duration_ms = frame_duration_;
+    signals.frames = stats.opus_packets - last_uplink_stats_.opus_packets;
+    signals.encode_us = stats.encode_us - last_uplink_stats_.encode_us;
+    signals.dropped = stats.pcm_dropped - last_uplink_stats_.pcm_dropped;
+    signals.sent = stats.sent - last_uplink_stats_.sent;
+    signals.send_us = stats.send_us - last_uplink_stats_.send_us;
+    signals.link_dropped = stats.opus_dropped - last_uplink_stats_.opus_dropped;
+    last_uplink_stats_ = stats;
+    if (signals.frames == 0) {
+        return;
+    }
+
+    signals.signal_quality = Board::GetInstance().GetSignalQuality();
+    if (encoder_controller_.Update(signals)) {
+        audio_uplink_.SetComplexity(encoder_controller_.complexity());
+        audio_uplink_.SetBitrate(encoder_controller_.bitrate());
+    }
+}
+
+// Called when the audio channel opens, before any audio of the session is sent
+void Application::SetUplinkFrameDuration(int frame_duration) {
+    ESP_LOGW(TAG, "Switching the uplink from %d ms to %d ms frames", frame_duration_.load(), frame_duration);
+    auto encoder = std::make_unique<UplinkEncoder>(16000, 1, frame_duration);
+    encoder->SetComplexity(encoder_controller_.complexity());
+    encoder->SetBitrate(encoder_controller_.bitrate());
+    encoder->SetDtx(opus_dtx_);
+    audio_uplink_.SetFrameDuration(encoder.get(), frame_duration);
+    // The uplink no longer uses the previous encoder
+    opus_encoder_ = std::move(encoder);
+    frame_duration_ = frame_duration;
+    // Later sessions propose what this server accepted
+    protocol_->SetFrameDuration(frame_duration);
+#if CONFIG_USE_WAKE_WORD_DETECT
+    wake_word_detect_.SetFrameDuration(frame_duration);
+#endif
+}
+
 // Add a async task to MainLoop
 void Application::Schedule(std::function<void()> callback) {
     {
@@ -644,7 +898,34 @@ void Application::AudioLoop() {
     }
 }
 
+// Called from the main loop, the audio loop and the clock timer while a reply is being played out
+void Application::CheckSpeakingDone() {
+    int64_t deadline = tts_drain_deadline_;
+    if (deadline == 0) {
+        return;
+    }
+    if (jitter_buffer_.Size() > 0 && !aborted_ && esp_timer_get_time() < deadline) {
+        return;
+    }
+    // Only one caller gets to schedule the transition
+    if (!tts_drain_deadline_.compare_exchange_strong(deadline, 0)) {
+        return;
+    }
+    Schedule([this]() {
+        // The last frame may still be decoding
+        background_task_->WaitForCompletion();
+        if (device_state_ == kDeviceStateSpeaking) {
+            if (listening_mode_ == kListeningModeManualStop) {
+                SetDeviceState(kDeviceStateIdle);
+            } else {
+                SetDeviceState(kDeviceStateListening);
+            }
+        }
+    });
+}
+
 void Application::OnAudioOutput() {
+    CheckSpeakingDone();
     if (busy_decoding_audio_) {
         return;
     }
@@ -653,8 +934,7 @@ void Application::OnAudioOutput() {
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
+    if (audio_decode_queue_.Empty() && jitter_buffer_.Size() == 0 && !IsPlayingSound()) {
         // Disable the output if there is no audio data for a long time
         if (device_state_ == kDeviceStateIdle) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
@@ -666,35 +946,66 @@ void Application::OnAudioOutput() {
     }
 
     if (device_state_ == kDeviceStateListening) {
-        audio_decode_queue_.clear();
-        audio_decode_cv_.notify_all();
+        StopSounds();
+        audio_decode_queue_.Clear();
+        jitter_buffer_.Reset(opus_decoder_->duration_ms());
         return;
     }
 
-    auto opus = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
-    audio_decode_cv_.notify_all();
-
     busy_decoding_audio_ = true;
-    background_task_->Schedule([this, codec, opus = std::move(opus)]() mutable {
+    background_task_->Schedule([this, codec]() {
         busy_decoding_audio_ = false;
-        if (aborted_) {
-            return;
+        // The packet is popped here so that it is copied straight into the reusable buffer.
+        // Sounds streamed through the decoder take priority over the network stream.
+        // They carry no receive time and are not traced
+        std::vector<int16_t> pcm;
+        int64_t receive_time = 0;
+        bool decoded = false;
+        bool has_packet = audio_decode_queue_.Pop(audio_decode_packet_);
+        if (!has_packet && !sound_streaming_) {
+            // A streamed sound may have left the decoder at the asset's parameters
+            if (protocol_) {
+                SetDecodeSampleRate(protocol_->server_sample_rate(), protocol_->server_frame_duration());
+            }
+            auto result = jitter_buffer_.Get(audio_decode_packet_, &receive_time);
+            if (result == kJitterBufferLost) {
+                // An empty packet makes the Opus decoder run packet loss concealment
+                audio_decode_packet_.clear();
+            }
+            has_packet = result != kJitterBufferEmpty;
+        }
+        if (has_packet && !aborted_ && opus_decoder_->Decode(std::move(audio_decode_packet_), pcm)) {
+            LatencyTracer::GetInstance().Record(kLatencyReceiveToDecoded, receive_time);
+            // Resample if the sample rate is different
+            if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
+                int target_size = output_resampler_.GetOutputSamples(pcm.size());
+                std::vector<int16_t> resampled(target_size);
+                output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
+                pcm = std::move(resampled);
+            }
+            decoded = !pcm.empty();
         }
 
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(opus), pcm)) {
+        // Cached sounds are mixed over the speech, frame by frame
+        size_t max_samples = decoded ? pcm.size() : codec->output_sample_rate() * OPUS_FRAME_DURATION_MS / 1000;
+        size_t sound_offset = 0;
+        size_t sound_samples = 0;
+        auto sound = OutputPlaylist(max_samples, sound_offset, sound_samples);
+        if (!decoded && sound == nullptr) {
             return;
         }
-        // Resample if the sample rate is different
-        if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+
+        audio_mixer_.Begin(decoded ? pcm.size() : sound_samples);
+        if (decoded) {
+            audio_mixer_.Add(kAudioMixerStreamSpeech, pcm.data(), pcm.size());
+        }
+        if (sound != nullptr) {
+            audio_mixer_.Add(kAudioMixerStreamNotification, sound->pcm + sound_offset, sound_samples);
+        }
+        codec->OutputData(audio_mixer_.Mix());
+        if (decoded) {
+            LatencyTracer::GetInstance().Record(kLatencyReceiveToOutput, receive_time);
         }
-        codec->OutputData(pcm);
         last_output_time_ = std::chrono::steady_clock::now();
     });
 }
@@ -702,81 +1013,35 @@ void Application::OnAudioOutput() {
 void Application::OnAudioInput() {
 #if CONFIG_USE_WAKE_WORD_DETECT
     if (wake_word_detect_.IsDetectionRunning()) {
-        std::vector<int16_t> data;
         int samples = wake_word_detect_.GetFeedSize();
         if (samples > 0) {
-            ReadAudio(data, 16000, samples);
-            wake_word_detect_.Feed(data);
+            audio_capture_.Read(audio_input_buffer_, samples);
+            wake_word_detect_.Feed(audio_input_buffer_);
             return;
         }
     }
 #endif
 #if CONFIG_USE_AUDIO_PROCESSOR
     if (audio_processor_.IsRunning()) {
-        std::vector<int16_t> data;
         int samples = audio_processor_.GetFeedSize();
         if (samples > 0) {
-            ReadAudio(data, 16000, samples);
-            audio_processor_.Feed(data);
+            audio_capture_.Read(audio_input_buffer_, samples);
+            audio_processor_.Feed(audio_input_buffer_, esp_timer_get_time());
             return;
         }
     }
 #else
-    if (device_state_ == kDeviceStateListening) {
-        std::vector<int16_t> data;
-        ReadAudio(data, 16000, 30 * 16000 / 1000);
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            if (protocol_->IsAudioChannelBusy()) {
-                return;
-            }
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
-            });
-        });
+    if (device_state_ == kDeviceStateListening || audio_uplink_.held()) {
+        // Short frames are read whole so each read completes one Opus frame without waiting for the next
+        int read_ms = std::min(frame_duration_.load(), 30);
+        audio_capture_.Read(audio_input_buffer_, read_ms * 16000 / 1000);
+        audio_uplink_.PushPcm(audio_input_buffer_.data(), audio_input_buffer_.size(), esp_timer_get_time());
         return;
     }
 #endif
     vTaskDelay(pdMS_TO_TICKS(30));
 }
 
-void Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (codec->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec->input_sample_rate() / sample_rate);
-        if (!codec->InputData(data)) {
-            return;
-        }
-        if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
-        }
-    } else {
-        data.resize(samples);
-        if (!codec->InputData(data)) {
-            return;
-        }
-    }
-}
-
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
@@ -794,6 +1059,11 @@ void Application::SetDeviceState(DeviceState state) {
     }
     
     clock_ticks_ = 0;
+    if (CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS > 0) {
+        // A warm channel is closed once the device has been idle for a while
+        idle_close_time_ = state == kDeviceStateIdle ?
+            esp_timer_get_time() + CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS * 1000000LL : 0;
+    }
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
@@ -812,6 +1082,11 @@ void Application::SetDeviceState(DeviceState state) {
 #if CONFIG_USE_AUDIO_PROCESSOR
             audio_processor_.Stop();
 #endif
+            if (audio_uplink_.held()) {
+                // The channel never opened, drop what was captured for it
+                audio_uplink_.Flush();
+                audio_uplink_.Release();
+            }
 #if CONFIG_USE_WAKE_WORD_DETECT
             wake_word_detect_.StartDetection();
 #endif
@@ -828,6 +1103,13 @@ void Application::SetDeviceState(DeviceState state) {
             // Update the IoT states before sending the start listening command
             UpdateIotStates();
 
+            if (audio_uplink_.held()) {
+                // Capture has been running since the wake word, what it held goes right after the command
+                protocol_->SendStartListening(listening_mode_);
+                audio_uplink_.Release();
+                break;
+            }
+
             // Make sure the audio processor is running
 #if CONFIG_USE_AUDIO_PROCESSOR
             if (!audio_processor_.IsRunning()) {
@@ -840,7 +1122,7 @@ void Application::SetDeviceState(DeviceState state) {
                     // FIXME: Wait for the speaker to empty the buffer
                     vTaskDelay(pdMS_TO_TICKS(120));
                 }
-                opus_encoder_->ResetState();
+                audio_uplink_.Flush();
 #if CONFIG_USE_WAKE_WORD_DETECT
                 wake_word_detect_.StopDetection();
 #endif
@@ -868,11 +1150,106 @@ void Application::SetDeviceState(DeviceState state) {
     }
 }
 
+bool Application::IsPlayingSound() {
+    return playlist_active_;
+}
+
+void Application::StopSounds() {
+    std::list<PlaylistItem> playlist;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        playlist.swap(playlist_);
+        playlist_active_ = false;
+        sound_streaming_ = false;
+    }
+    // A cut short playlist is still reported as done
+    for (auto& item : playlist) {
+        if (item.on_complete) {
+            Schedule(item.on_complete);
+        }
+    }
+}
+
+// Advances the playlist by one frame. For a cached sound, up to max_samples samples of it are
+// returned for the caller to mix. Sounds that could not be cached are streamed into the decode
+// queue instead, as much as fits, and decoded by the caller like any other packet. The network
+// stream is held in the jitter buffer meanwhile, since it needs the decoder set up differently.
+std::shared_ptr<const CachedSound> Application::OutputPlaylist(size_t max_samples, size_t& offset, size_t& samples) {
+    std::shared_ptr<const CachedSound> sound;
+    // Called for every output frame, take the lock only while there is something to advance
+    if (!playlist_active_) {
+        return sound;
+    }
+    std::vector<std::function<void()>> completed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!playlist_.empty()) {
+            auto& item = playlist_.front();
+            if (!item.prepared) {
+                break;
+            }
+
+            if (item.pcm != nullptr) {
+                // A streamed sound ahead of this one has to drain first
+                if (!audio_decode_queue_.Empty()) {
+                    break;
+                }
+                sound = item.pcm;
+                offset = item.offset;
+                samples = std::min(sound->samples - offset, max_samples);
+                item.offset += samples;
+                if (item.offset >= sound->samples) {
+                    if (item.on_complete) {
+                        completed.push_back(std::move(item.on_complete));
+                    }
+                    playlist_.pop_front();
+                }
+                break;
+            }
+
+            if (item.offset == 0) {
+                // The decoder and the resampler are shared with the speech, wait for it to end
+                // before switching them
+                if (jitter_buffer_.Size() > 0 || device_state_ == kDeviceStateSpeaking) {
+                    break;
+                }
+                // The assets are encoded at 16000Hz, 60ms frame duration
+                SetDecodeSampleRate(16000, 60);
+                sound_streaming_ = true;
+            }
+            // The payloads are queued as views into the embedded asset, nothing is copied until decoding
+            while (item.offset + sizeof(BinaryProtocol3) <= item.sound.size()) {
+                auto p3 = (const BinaryProtocol3*)(item.sound.data() + item.offset);
+                auto payload_size = ntohs(p3->payload_size);
+                if (!audio_decode_queue_.PushView(p3->payload, payload_size) &&
+                    payload_size <= audio_decode_queue_.max_packet_size()) {
+                    break;
+                }
+                item.offset += sizeof(BinaryProtocol3) + payload_size;
+            }
+            if (item.offset + sizeof(BinaryProtocol3) <= item.sound.size() || !audio_decode_queue_.Empty()) {
+                break;
+            }
+            // Fully played, move on to the next sound
+            sound_streaming_ = false;
+            if (item.on_complete) {
+                completed.push_back(std::move(item.on_complete));
+            }
+            playlist_.pop_front();
+        }
+        playlist_active_ = !playlist_.empty();
+    }
+    for (auto& callback : completed) {
+        Schedule(callback);
+    }
+    return sound;
+}
+
 void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    StopSounds();
     opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
-    audio_decode_cv_.notify_all();
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset(opus_decoder_->duration_ms());
     last_output_time_ = std::chrono::steady_clock::now();
     
     auto codec = Board::GetInstance().GetAudioCodec();
@@ -890,7 +1267,7 @@ void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
         ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate(), kResamplerQualityHigh);
     }
 }
 
@@ -921,7 +1298,13 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
         });
     } else if (device_state_ == kDeviceStateListening) {   
         Schedule([this]() {
-            if (protocol_) {
+            if (!protocol_) {
+                return;
+            }
+            if (CONFIG_AUDIO_CHANNEL_KEEP_WARM_SECONDS > 0) {
+                protocol_->SendStopListening();
+                SetDeviceState(kDeviceStateIdle);
+            } else {
                 protocol_->CloseAudioChannel();
             }
         });
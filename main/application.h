@@ -11,14 +11,22 @@
 #include <list>
 #include <vector>
 #include <condition_variable>
+#include <atomic>
 
-#include <opus_encoder.h>
 #include <opus_decoder.h>
-#include <opus_resampler.h>
 
 #include "protocol.h"
+#include "audio_resampler.h"
 #include "ota.h"
 #include "background_task.h"
+#include "packet_ring.h"
+#include "jitter_buffer.h"
+#include "audio_capture.h"
+#include "audio_uplink.h"
+#include "uplink_encoder.h"
+#include "encoder_controller.h"
+#include "sound_cache.h"
+#include "audio_mixer.h"
 
 #if CONFIG_USE_WAKE_WORD_DETECT
 #include "wake_word_detect.h"
@@ -31,6 +39,7 @@
 #define AUDIO_INPUT_READY_EVENT (1 << 1)
 #define AUDIO_OUTPUT_READY_EVENT (1 << 2)
 #define CHECK_NEW_VERSION_DONE_EVENT (1 << 3)
+#define WARM_UP_DONE_EVENT (1 << 4)
 
 enum DeviceState {
     kDeviceStateUnknown,
@@ -46,6 +55,19 @@ enum DeviceState {
 };
 
 #define OPUS_FRAME_DURATION_MS 60
+#if CONFIG_REALTIME_CHAT_FRAME_DURATION_20MS
+#define OPUS_REALTIME_FRAME_DURATION_MS 20
+#elif CONFIG_REALTIME_CHAT_FRAME_DURATION_40MS
+#define OPUS_REALTIME_FRAME_DURATION_MS 40
+#else
+#define OPUS_REALTIME_FRAME_DURATION_MS OPUS_FRAME_DURATION_MS
+#endif
+#define AUDIO_DECODE_QUEUE_CAPACITY 16
+// How long a tts stop waits for the jitter buffer to play out
+#define TTS_DRAIN_TIMEOUT_MS 1000
+#define ENCODER_CONTROL_INTERVAL_SECONDS 5
+// Minimum time between two speculative connects, they are triggered by every VAD onset
+#define AUDIO_CHANNEL_WARM_UP_INTERVAL_SECONDS 30
 
 class Application {
 public:
@@ -71,7 +93,14 @@ public:
     void UpdateIotStates();
     void Reboot();
     void WakeWordInvoke(const std::string& wake_word);
+    // Hint that the user is about to start a conversation, e.g. a button was pressed down.
+    // With the keep-warm policy the audio channel is opened ahead of time on its own task.
+    // Opt-in per board: only boards that call it from an input callback get the early handshake.
+    void PrepareAudioChannel();
     void PlaySound(const std::string_view& sound);
+    // Queues the sounds back to back after anything already playing, without blocking.
+    // on_complete runs on the main loop once the last one has played or playback was cut short.
+    void PlaySounds(const std::vector<std::string_view>& sounds, std::function<void()> on_complete = nullptr);
     bool CanEnterSleepMode();
 
 private:
@@ -97,7 +126,19 @@ private:
 #else
     bool realtime_chat_enabled_ = false;
 #endif
+    // Uplink Opus frame duration proposed in hello, switched to the one the server accepted
+    std::atomic<int> frame_duration_{OPUS_FRAME_DURATION_MS};
+    bool opus_dtx_ = false;
     bool aborted_ = false;
+    // Set by the tts stop message while the jitter buffer plays out, esp_timer time to give up at or 0
+    std::atomic<int64_t> tts_drain_deadline_{0};
+    // Set while PrepareAudioChannel() opens the channel off the main loop
+    std::atomic<bool> warming_up_{false};
+    int64_t last_warm_up_time_ = 0;
+    // The channel opened while warming up, the main loop still has to set the session up
+    std::atomic<bool> audio_channel_setup_pending_{false};
+    // esp_timer time to close the idle warm channel at, or 0
+    std::atomic<int64_t> idle_close_time_{0};
     bool voice_detected_ = false;
     bool busy_decoding_audio_ = false;
     int clock_ticks_ = 0;
@@ -107,25 +148,56 @@ private:
     TaskHandle_t audio_loop_task_handle_ = nullptr;
     BackgroundTask* background_task_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<std::vector<uint8_t>> audio_decode_queue_;
-    std::condition_variable audio_decode_cv_;
-
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    PacketRing audio_decode_queue_;
+    JitterBuffer jitter_buffer_;
+    std::vector<uint8_t> audio_decode_packet_;
+
+    AudioUplink audio_uplink_;
+    EncoderController encoder_controller_;
+    AudioUplinkStats last_uplink_stats_;
+    std::unique_ptr<UplinkEncoder> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
 
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // Built-in sounds waiting to be played, guarded by mutex_
+    struct PlaylistItem {
+        uint32_t id = 0;
+        std::string_view sound;
+        bool prepared = false;                      // Looked up in the sound cache
+        std::shared_ptr<const CachedSound> pcm;     // Decoded PCM, or null to stream the asset
+        size_t offset = 0;                          // Samples output from pcm, or bytes queued from sound
+        std::function<void()> on_complete;
+    };
+    std::list<PlaylistItem> playlist_;
+    uint32_t playlist_item_id_ = 0;
+    // Mirrors !playlist_.empty() so that the audio loop can check it without the lock
+    std::atomic<bool> playlist_active_{false};
+    // Set while an uncached sound owns the decoder
+    std::atomic<bool> sound_streaming_{false};
+    SoundCache sound_cache_;
+    AudioMixer audio_mixer_;
+
+    AudioCapture audio_capture_;
+    std::vector<int16_t> audio_input_buffer_;
+    AudioResampler output_resampler_;
 
     void MainEventLoop();
     void OnAudioInput();
     void OnAudioOutput();
-    void ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    bool IsPlayingSound();
+    void StopSounds();
+    std::shared_ptr<const CachedSound> OutputPlaylist(size_t max_samples, size_t& offset, size_t& samples);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
     void CheckNewVersion();
     void ShowActivationCode();
     void OnClockTimer();
+    void CheckSpeakingDone();
+    void UpdateEncoderSettings();
+    void SetUplinkFrameDuration(int frame_duration);
+    void WarmUpAudioChannel();
+    void WaitForWarmUp();
+    bool IsAudioChannelWarm();
+    void SetUpAudioChannel();
     void SetListeningMode(ListeningMode mode);
     void AudioLoop();
 };
@@ -0,0 +1,60 @@
+#include "audio_capture.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioCapture"
+
+void AudioCapture::Configure(AudioCodec* codec, int sample_rate) {
+    codec_ = codec;
+    sample_rate_ = sample_rate;
+    if (codec_->input_sample_rate() != sample_rate_) {
+        // Same quality on both channels, the AEC needs the reference delayed exactly like the mic
+        input_resampler_.Configure(codec_->input_sample_rate(), sample_rate_, kResamplerQualityMedium);
+        reference_resampler_.Configure(codec_->input_sample_rate(), sample_rate_, kResamplerQualityMedium);
+    }
+}
+
+void AudioCapture::Reserve(std::vector<int16_t>& buffer, size_t samples) {
+    if (buffer.capacity() < samples) {
+        ESP_LOGI(TAG, "Grow capture buffer from %zu to %zu samples", buffer.capacity(), samples);
+        buffer.reserve(samples);
+    }
+    buffer.resize(samples);
+}
+
+bool AudioCapture::Read(std::vector<int16_t>& data, int samples) {
+    if (codec_->input_sample_rate() == sample_rate_) {
+        Reserve(data, samples);
+        return codec_->InputData(data);
+    }
+
+    Reserve(raw_, samples * codec_->input_sample_rate() / sample_rate_);
+    if (!codec_->InputData(raw_)) {
+        return false;
+    }
+
+    if (codec_->input_channels() == 2) {
+        size_t frames = raw_.size() / 2;
+        Reserve(mic_, frames);
+        Reserve(reference_, frames);
+        for (size_t i = 0, j = 0; i < frames; ++i, j += 2) {
+            mic_[i] = raw_[j];
+            reference_[i] = raw_[j + 1];
+        }
+
+        Reserve(resampled_mic_, input_resampler_.GetOutputSamples(frames));
+        Reserve(resampled_reference_, reference_resampler_.GetOutputSamples(frames));
+        input_resampler_.Process(mic_.data(), frames, resampled_mic_.data());
+        reference_resampler_.Process(reference_.data(), frames, resampled_reference_.data());
+
+        Reserve(data, resampled_mic_.size() + resampled_reference_.size());
+        for (size_t i = 0, j = 0; i < resampled_mic_.size(); ++i, j += 2) {
+            data[j] = resampled_mic_[i];
+            data[j + 1] = resampled_reference_[i];
+        }
+    } else {
+        Reserve(data, input_resampler_.GetOutputSamples(raw_.size()));
+        input_resampler_.Process(raw_.data(), raw_.size(), data.data());
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef AUDIO_CAPTURE_H
+#define AUDIO_CAPTURE_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_codec.h"
+#include "audio_resampler.h"
+
+// Reads microphone frames from the codec and converts them to the requested
+// sample rate. All scratch buffers are owned here and only grow, so once the
+// first frame has been read the capture path does not touch the heap.
+class AudioCapture {
+public:
+    void Configure(AudioCodec* codec, int sample_rate);
+    // `samples` counts all channels at the output sample rate. `data` is resized,
+    // callers should keep it alive between frames to reuse its capacity.
+    bool Read(std::vector<int16_t>& data, int samples);
+
+    inline int sample_rate() const { return sample_rate_; }
+
+private:
+    AudioCodec* codec_ = nullptr;
+    int sample_rate_ = 16000;
+    AudioResampler input_resampler_;
+    AudioResampler reference_resampler_;
+
+    std::vector<int16_t> raw_;
+    std::vector<int16_t> mic_;
+    std::vector<int16_t> reference_;
+    std::vector<int16_t> resampled_mic_;
+    std::vector<int16_t> resampled_reference_;
+
+    static void Reserve(std::vector<int16_t>& buffer, size_t samples);
+};
+
+#endif // AUDIO_CAPTURE_H
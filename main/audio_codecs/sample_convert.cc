@@ -0,0 +1,67 @@
+#include "sample_convert.h"
+
+#include <cmath>
+
+int32_t VolumeToGainQ16(int volume) {
+    return pow(double(volume) / 100.0, 2) * 65536;
+}
+
+static inline int32_t SaturateS64(int64_t value) {
+    if (value > INT32_MAX) {
+        return INT32_MAX;
+    } else if (value < INT32_MIN) {
+        return INT32_MIN;
+    }
+    return (int32_t)value;
+}
+
+static inline int16_t SaturateS16Symmetric(int32_t value) {
+    // Written as min/max so that GCC emits CLAMPS on Xtensa
+    value = value > INT16_MAX ? INT16_MAX : value;
+    value = value < -INT16_MAX ? -INT16_MAX : value;
+    return (int16_t)value;
+}
+
+void ConvertS16ToS32Gain(const int16_t* in, int32_t* out, size_t samples, int32_t gain_q16) {
+    if (gain_q16 < 0 || gain_q16 > 65536) {
+        // Only volumes above 100 can overflow, take the slow 64-bit path for them
+        for (size_t i = 0; i < samples; i++) {
+            out[i] = SaturateS64(int64_t(in[i]) * gain_q16);
+        }
+        return;
+    }
+
+    // |in| <= 32768 and gain <= 65536, so the product always fits in 32 bits:
+    // a single MULL per sample, no 64-bit multiply and no clamp
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        int32_t s0 = in[i] * gain_q16;
+        int32_t s1 = in[i + 1] * gain_q16;
+        int32_t s2 = in[i + 2] * gain_q16;
+        int32_t s3 = in[i + 3] * gain_q16;
+        out[i] = s0;
+        out[i + 1] = s1;
+        out[i + 2] = s2;
+        out[i + 3] = s3;
+    }
+    for (; i < samples; i++) {
+        out[i] = in[i] * gain_q16;
+    }
+}
+
+void ConvertS32ToS16Shift(const int32_t* in, int16_t* out, size_t samples, int shift) {
+    size_t i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        int16_t s0 = SaturateS16Symmetric(in[i] >> shift);
+        int16_t s1 = SaturateS16Symmetric(in[i + 1] >> shift);
+        int16_t s2 = SaturateS16Symmetric(in[i + 2] >> shift);
+        int16_t s3 = SaturateS16Symmetric(in[i + 3] >> shift);
+        out[i] = s0;
+        out[i + 1] = s1;
+        out[i + 2] = s2;
+        out[i + 3] = s3;
+    }
+    for (; i < samples; i++) {
+        out[i] = SaturateS16Symmetric(in[i] >> shift);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef _SAMPLE_CONVERT_H
+#define _SAMPLE_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Sample format conversion kernels shared by the I2S codecs.
+// All of them saturate and are bit-exact with the straightforward scalar code.
+
+// Gain that maps output_volume (0-100) to a Q16 factor, volume^2 curve
+int32_t VolumeToGainQ16(int volume);
+
+// out[i] = saturate32(in[i] * gain_q16)
+void ConvertS16ToS32Gain(const int16_t* in, int32_t* out, size_t samples, int32_t gain_q16);
+
+// out[i] = clamp(in[i] >> shift, -INT16_MAX, INT16_MAX)
+void ConvertS32ToS16Shift(const int32_t* in, int16_t* out, size_t samples, int shift);
+
+#endif // _SAMPLE_CONVERT_H
@@ -0,0 +1,71 @@
+#include "audio_mixer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "AudioMixer"
+
+void AudioMixer::SetGain(AudioMixerStream stream, int32_t gain) {
+    inputs_[stream].gain = std::clamp<int32_t>(gain, 0, AUDIO_MIXER_UNITY_GAIN);
+}
+
+void AudioMixer::SetDuckingGain(int32_t gain) {
+    ducking_gain_ = std::clamp<int32_t>(gain, 0, AUDIO_MIXER_UNITY_GAIN);
+}
+
+void AudioMixer::Begin(size_t samples) {
+    block_samples_ = samples;
+    for (auto& input : inputs_) {
+        input.pcm = nullptr;
+        input.samples = 0;
+    }
+}
+
+void AudioMixer::Add(AudioMixerStream stream, const int16_t* pcm, size_t samples) {
+    inputs_[stream].pcm = pcm;
+    inputs_[stream].samples = std::min(samples, block_samples_);
+}
+
+std::vector<int16_t>& AudioMixer::Mix() {
+    if (output_.capacity() < block_samples_) {
+        ESP_LOGI(TAG, "Grow mixer buffers from %zu to %zu samples", output_.capacity(), block_samples_);
+        accumulator_.reserve(block_samples_);
+        output_.reserve(block_samples_);
+    }
+    accumulator_.assign(block_samples_, 0);
+    output_.resize(block_samples_);
+
+    bool ducking = inputs_[kAudioMixerStreamNotification].samples > 0;
+    int active = 0;
+    for (int i = 0; i < kAudioMixerStreamCount; i++) {
+        auto& input = inputs_[i];
+        int32_t target = input.gain;
+        if (i == kAudioMixerStreamSpeech && ducking) {
+            target = (target * ducking_gain_) >> 15;
+        }
+        if (input.samples == 0) {
+            // Nothing to ramp on, jump to the target
+            input.current_gain = target;
+            continue;
+        }
+        active++;
+
+        // Q30 gain stepping linearly from the current to the target gain over the block
+        int32_t gain = input.current_gain << 15;
+        int32_t step = block_samples_ > 0 ? ((target - input.current_gain) << 15) / (int32_t)block_samples_ : 0;
+        for (size_t j = 0; j < input.samples; j++) {
+            accumulator_[j] += (input.pcm[j] * (gain >> 15)) >> 15;
+            gain += step;
+        }
+        input.current_gain = target;
+    }
+
+    if (active == 0) {
+        std::fill(output_.begin(), output_.end(), 0);
+        return output_;
+    }
+    for (size_t j = 0; j < block_samples_; j++) {
+        output_[j] = std::clamp<int32_t>(accumulator_[j], INT16_MIN, INT16_MAX);
+    }
+    return output_;
+}
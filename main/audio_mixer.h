@@ -0,0 +1,50 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Gains are Q15, 32768 is unity
+#define AUDIO_MIXER_UNITY_GAIN 32768
+// Speech is lowered by 12dB while a notification plays over it
+#define AUDIO_MIXER_DUCKING_GAIN 8192
+
+enum AudioMixerStream {
+    kAudioMixerStreamSpeech,        // Decoded TTS from the server
+    kAudioMixerStreamNotification,  // Built-in sounds
+    kAudioMixerStreamCount
+};
+
+// Mixes the output streams block by block in saturating fixed point, just before
+// AudioCodec::OutputData. Gain changes, including ducking, ramp over one block so
+// they do not click. Only used by the audio output job, so it is not thread safe.
+class AudioMixer {
+public:
+    void SetGain(AudioMixerStream stream, int32_t gain);
+    // Gain applied on top of the speech gain while a notification is playing
+    void SetDuckingGain(int32_t gain);
+
+    // Starts a block of `samples` samples, streams not added to it stay silent
+    void Begin(size_t samples);
+    // `pcm` must stay valid until Mix(), samples beyond the block are ignored
+    void Add(AudioMixerStream stream, const int16_t* pcm, size_t samples);
+    // Mixes the block, the returned buffer is reused by the next block
+    std::vector<int16_t>& Mix();
+
+private:
+    struct Input {
+        const int16_t* pcm = nullptr;
+        size_t samples = 0;
+        int32_t gain = AUDIO_MIXER_UNITY_GAIN;          // Set by the user
+        int32_t current_gain = AUDIO_MIXER_UNITY_GAIN;  // Reached at the end of the last block
+    };
+
+    Input inputs_[kAudioMixerStreamCount];
+    int32_t ducking_gain_ = AUDIO_MIXER_DUCKING_GAIN;
+    size_t block_samples_ = 0;
+    std::vector<int32_t> accumulator_;
+    std::vector<int16_t> output_;
+};
+
+#endif // AUDIO_MIXER_H
@@ -1,4 +1,5 @@
 #include "audio_processor.h"
+#include "latency_tracer.h"
 #include <esp_log.h>
 
 #define PROCESSOR_RUNNING 0x01
@@ -71,13 +72,42 @@ size_t AudioProcessor::GetFeedSize() {
     return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
 }
 
-void AudioProcessor::Feed(const std::vector<int16_t>& data) {
+void AudioProcessor::Feed(const std::vector<int16_t>& data, int64_t capture_time) {
     if (afe_data_ == nullptr) {
         return;
     }
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        if (pending_count_ == AUDIO_PROCESSOR_MAX_PENDING_FEEDS) {
+            // AFE is not fetching, forget the oldest
+            pending_head_ = (pending_head_ + 1) % AUDIO_PROCESSOR_MAX_PENDING_FEEDS;
+            pending_count_--;
+        }
+        auto& feed = pending_feeds_[(pending_head_ + pending_count_) % AUDIO_PROCESSOR_MAX_PENDING_FEEDS];
+        feed.capture_time = capture_time;
+        feed.samples = data.size() / codec_->input_channels();
+        pending_count_++;
+    }
     afe_iface_->feed(afe_data_, data.data());
 }
 
+int64_t AudioProcessor::ConsumePendingFeeds(size_t samples) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    int64_t capture_time = 0;
+    while (samples > 0 && pending_count_ > 0) {
+        auto& feed = pending_feeds_[pending_head_];
+        capture_time = feed.capture_time;
+        if (feed.samples > samples) {
+            feed.samples -= samples;
+            break;
+        }
+        samples -= feed.samples;
+        pending_head_ = (pending_head_ + 1) % AUDIO_PROCESSOR_MAX_PENDING_FEEDS;
+        pending_count_--;
+    }
+    return capture_time;
+}
+
 void AudioProcessor::Start() {
     xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
 }
@@ -87,13 +117,16 @@ void AudioProcessor::Stop() {
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_head_ = 0;
+    pending_count_ = 0;
 }
 
 bool AudioProcessor::IsRunning() {
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
 }
 
-void AudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void AudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data, int64_t capture_time)> callback) {
     output_callback_ = callback;
 }
 
@@ -132,8 +165,12 @@ void AudioProcessor::AudioProcessorTask() {
             }
         }
 
+        size_t samples = res->data_size / sizeof(int16_t);
+        int64_t capture_time = ConsumePendingFeeds(samples);
+        LatencyTracer::GetInstance().Record(kLatencyCaptureToAfe, capture_time);
+
         if (output_callback_) {
-            output_callback_(std::vector<int16_t>(res->data, res->data + res->data_size / sizeof(int16_t)));
+            output_callback_(std::vector<int16_t>(res->data, res->data + samples), capture_time);
         }
     }
 }
@@ -9,20 +9,26 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <mutex>
 
 #include "audio_codec.h"
 
+// Capture times of feeds the AFE has not output yet
+#define AUDIO_PROCESSOR_MAX_PENDING_FEEDS 16
+
 class AudioProcessor {
 public:
     AudioProcessor();
     ~AudioProcessor();
 
     void Initialize(AudioCodec* codec, bool realtime_chat);
-    void Feed(const std::vector<int16_t>& data);
+    // `capture_time` is the esp_timer time the frame was read from the codec
+    void Feed(const std::vector<int16_t>& data, int64_t capture_time = 0);
     void Start();
     void Stop();
     bool IsRunning();
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback);
+    // `capture_time` is that of the newest fed frame contributing to the output
+    void OnOutput(std::function<void(std::vector<int16_t>&& data, int64_t capture_time)> callback);
     void OnVadStateChange(std::function<void(bool speaking)> callback);
     size_t GetFeedSize();
 
@@ -30,12 +36,22 @@ private:
     EventGroupHandle_t event_group_ = nullptr;
     esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::function<void(std::vector<int16_t>&& data, int64_t capture_time)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
     bool is_speaking_ = false;
 
+    struct PendingFeed {
+        int64_t capture_time;
+        size_t samples;
+    };
+    std::mutex pending_mutex_;
+    PendingFeed pending_feeds_[AUDIO_PROCESSOR_MAX_PENDING_FEEDS];
+    size_t pending_head_ = 0;
+    size_t pending_count_ = 0;
+
     void AudioProcessorTask();
+    int64_t ConsumePendingFeeds(size_t samples);
 };
 
 #endif
@@ -2,8 +2,11 @@
 #include "application.h"
 
 #include <esp_log.h>
+#include <esp_heap_caps.h>
 #include <model_path.h>
+#include <opus_encoder.h>
 #include <arpa/inet.h>
+#include <algorithm>
 #include <sstream>
 
 #define DETECTION_RUNNING_EVENT 1
@@ -11,9 +14,7 @@
 static const char* TAG = "WakeWordDetect";
 
 WakeWordDetect::WakeWordDetect()
-    : afe_data_(nullptr),
-      wake_word_pcm_(),
-      wake_word_opus_() {
+    : afe_data_(nullptr) {
 
     event_group_ = xEventGroupCreate();
 }
@@ -27,11 +28,17 @@ WakeWordDetect::~WakeWordDetect() {
         heap_caps_free(wake_word_encode_task_stack_);
     }
 
+    if (wake_word_pcm_ != nullptr) {
+        heap_caps_free(wake_word_pcm_);
+    }
+
     vEventGroupDelete(event_group_);
 }
 
-void WakeWordDetect::Initialize(AudioCodec* codec) {
+void WakeWordDetect::Initialize(AudioCodec* codec, int frame_duration_ms) {
     codec_ = codec;
+    wake_word_frame_duration_ = frame_duration_ms;
+    wake_word_encoded_duration_ = frame_duration_ms;
     int ref_num = codec_->input_reference() ? 1 : 0;
 
     srmodel_list_t *models = esp_srmodel_init("model");
@@ -71,6 +78,30 @@ void WakeWordDetect::Initialize(AudioCodec* codec) {
         this_->AudioDetectionTask();
         vTaskDelete(NULL);
     }, "audio_detection", 4096, this, 3, nullptr);
+
+    // The pre-roll buffers and the encoder stack live in PSRAM and are allocated once
+    wake_word_pcm_capacity_ = 16000 * WAKE_WORD_PCM_BUFFER_MS / 1000;
+    wake_word_pcm_ = (int16_t*)heap_caps_malloc(wake_word_pcm_capacity_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    wake_word_max_packets_ = WAKE_WORD_PREROLL_MS / wake_word_frame_duration_;
+    wake_word_opus_ = std::make_unique<PacketRing>();
+    wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    if (wake_word_pcm_ == nullptr || wake_word_encode_task_stack_ == nullptr ||
+        !wake_word_opus_->Allocate(wake_word_max_packets_)) {
+        ESP_LOGE(TAG, "Failed to allocate the wake word pre-roll");
+        return;
+    }
+    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto this_ = (WakeWordDetect*)arg;
+        this_->WakeWordEncodeTask();
+        vTaskDelete(NULL);
+    }, "encode_detect_packets", 4096 * 8, this, 1, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+}
+
+void WakeWordDetect::SetFrameDuration(int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    wake_word_frame_duration_ = frame_duration_ms;
+    // The ring was sized at Initialize(), shorter frames cover a shorter pre-roll
+    wake_word_max_packets_ = std::min<size_t>(WAKE_WORD_PREROLL_MS / frame_duration_ms, wake_word_opus_->capacity());
 }
 
 void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -78,6 +109,7 @@ void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wa
 }
 
 void WakeWordDetect::StartDetection() {
+    ResetWakeWordData();
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
 
@@ -121,7 +153,7 @@ void WakeWordDetect::AudioDetectionTask() {
         }
 
         // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData((uint16_t*)res->data, res->data_size / sizeof(uint16_t));
+        StoreWakeWordData((const int16_t*)res->data, res->data_size / sizeof(int16_t));
 
         if (res->wakeup_state == WAKENET_DETECTED) {
             StopDetection();
@@ -134,54 +166,116 @@ void WakeWordDetect::AudioDetectionTask() {
     }
 }
 
-void WakeWordDetect::StoreWakeWordData(uint16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 32ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 32) {
-        wake_word_pcm_.pop_front();
+void WakeWordDetect::StoreWakeWordData(const int16_t* data, size_t samples) {
+    if (wake_word_pcm_ == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        samples = std::min(samples, wake_word_pcm_capacity_);
+        size_t offset = wake_word_pcm_write_ % wake_word_pcm_capacity_;
+        size_t first = std::min(samples, wake_word_pcm_capacity_ - offset);
+        std::copy(data, data + first, wake_word_pcm_ + offset);
+        std::copy(data + first, data + samples, wake_word_pcm_);
+        wake_word_pcm_write_ += samples;
+        // Overwrite the oldest PCM if the encoder is starved
+        if (wake_word_pcm_write_ - wake_word_pcm_read_ > wake_word_pcm_capacity_) {
+            wake_word_pcm_read_ = wake_word_pcm_write_ - wake_word_pcm_capacity_;
+        }
     }
+    wake_word_cv_.notify_all();
 }
 
-void WakeWordDetect::EncodeWakeWordData() {
-    wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
-    }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (WakeWordDetect*)arg;
-        {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
-
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-            }
-            this_->wake_word_pcm_.clear();
+void WakeWordDetect::ResetWakeWordData() {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    wake_word_pcm_read_ = 0;
+    wake_word_pcm_write_ = 0;
+    wake_word_reset_ = true;
+    wake_word_drain_ = false;
+    wake_word_drained_ = false;
+    wake_word_cv_.notify_all();
+}
 
-            auto end_time = esp_timer_get_time();
-            ESP_LOGI(TAG, "Encode wake word opus %zu packets in %lld ms",
-                this_->wake_word_opus_.size(), (end_time - start_time) / 1000);
+void WakeWordDetect::WakeWordEncodeTask() {
+    int frame_duration = wake_word_encoded_duration_;
+    auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration);
+    encoder->SetComplexity(0); // 0 is the fastest
+    size_t frame_samples = 16000 * frame_duration / 1000;
+    std::vector<int16_t> pcm;
 
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
+    while (true) {
+        std::unique_lock<std::mutex> lock(wake_word_mutex_);
+        wake_word_cv_.wait(lock, [this, &frame_samples]() {
+            return wake_word_reset_ || wake_word_pcm_write_ - wake_word_pcm_read_ >= frame_samples ||
+                (wake_word_drain_ && !wake_word_drained_);
+        });
+        if (wake_word_reset_) {
+            wake_word_reset_ = false;
+            bool reconfigure = frame_duration != wake_word_frame_duration_;
+            frame_duration = wake_word_frame_duration_;
+            wake_word_encoded_duration_ = frame_duration;
+            lock.unlock();
+            wake_word_opus_->Clear();
+            if (reconfigure) {
+                ESP_LOGI(TAG, "Wake word pre-roll frame duration: %d ms", frame_duration);
+                encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration);
+                encoder->SetComplexity(0);
+                frame_samples = 16000 * frame_duration / 1000;
+            } else {
+                encoder->ResetState();
+            }
+            continue;
         }
-        vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+        if (wake_word_pcm_write_ - wake_word_pcm_read_ < frame_samples) {
+            // Less than a frame is left after the wake word, the pre-roll is complete
+            wake_word_drained_ = true;
+            wake_word_cv_.notify_all();
+            continue;
+        }
+
+        pcm.resize(frame_samples);
+        size_t offset = wake_word_pcm_read_ % wake_word_pcm_capacity_;
+        size_t first = std::min(frame_samples, wake_word_pcm_capacity_ - offset);
+        std::copy(wake_word_pcm_ + offset, wake_word_pcm_ + offset + first, pcm.begin());
+        std::copy(wake_word_pcm_, wake_word_pcm_ + frame_samples - first, pcm.begin() + first);
+        wake_word_pcm_read_ += frame_samples;
+        size_t max_packets = wake_word_max_packets_;
+        lock.unlock();
+
+        encoder->Encode(std::move(pcm), [this, max_packets](std::vector<uint8_t>&& opus) {
+            // Keep only the last WAKE_WORD_PREROLL_MS
+            while (wake_word_opus_->Size() >= max_packets) {
+                wake_word_opus_->DropOldest();
+            }
+            if (!wake_word_opus_->Push(opus.data(), opus.size())) {
+                ESP_LOGW(TAG, "Drop wake word packet of %zu bytes", opus.size());
+            }
+        });
+        // GetWakeWordOpus checks the ring under the lock, so it cannot miss this notification
+        lock.lock();
+        wake_word_cv_.notify_all();
+    }
+}
+
+void WakeWordDetect::EncodeWakeWordData() {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    wake_word_drain_ = true;
+    wake_word_drained_ = false;
+    wake_word_cv_.notify_all();
 }
 
 bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+    if (wake_word_encode_task_ == nullptr) {
+        return false;
+    }
     std::unique_lock<std::mutex> lock(wake_word_mutex_);
     wake_word_cv_.wait(lock, [this]() {
-        return !wake_word_opus_.empty();
+        return !wake_word_opus_->Empty() || wake_word_drained_;
     });
-    opus.swap(wake_word_opus_.front());
-    wake_word_opus_.pop_front();
-    return !opus.empty();
+    return wake_word_opus_->Pop(opus);
+}
+
+int WakeWordDetect::GetWakeWordFrameDuration() {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    return wake_word_encoded_duration_;
 }
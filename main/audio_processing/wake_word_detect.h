@@ -8,29 +8,42 @@
 #include <esp_afe_sr_models.h>
 #include <esp_nsn_models.h>
 
-#include <list>
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
 
 #include "audio_codec.h"
+#include "packet_ring.h"
+
+// Audio kept from before the wake word, sent to the server for speaker recognition
+#define WAKE_WORD_PREROLL_MS 2000
+// PCM waiting for the pre-roll encoder, it only falls behind while the CPU is busy
+#define WAKE_WORD_PCM_BUFFER_MS 500
 
 class WakeWordDetect {
 public:
     WakeWordDetect();
     ~WakeWordDetect();
 
-    void Initialize(AudioCodec* codec);
+    // The pre-roll is encoded in frames of frame_duration_ms, like the rest of the uplink
+    void Initialize(AudioCodec* codec, int frame_duration_ms);
+    // Follows the uplink frame duration the server accepted, applied from the next StartDetection()
+    void SetFrameDuration(int frame_duration_ms);
     void Feed(const std::vector<int16_t>& data);
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
     void StartDetection();
     void StopDetection();
     bool IsDetectionRunning();
     size_t GetFeedSize();
+    // Encodes what is left of the pre-roll once the wake word has been detected
     void EncodeWakeWordData();
+    // Returns the pre-roll packets oldest first, false once all of them have been returned
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    // Frame duration of the packets currently in the pre-roll
+    int GetWakeWordFrameDuration();
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
@@ -43,16 +56,29 @@ private:
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
 
+    // The pre-roll is encoded continuously by a low priority task, so it is ready as soon as
+    // the wake word is detected. The PCM ring is guarded by wake_word_mutex_.
+    int wake_word_frame_duration_ = 60;
+    int wake_word_encoded_duration_ = 60;
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    int16_t* wake_word_pcm_ = nullptr;
+    size_t wake_word_pcm_capacity_ = 0;
+    size_t wake_word_pcm_read_ = 0;
+    size_t wake_word_pcm_write_ = 0;
+    std::unique_ptr<PacketRing> wake_word_opus_;
+    size_t wake_word_max_packets_ = 0;
+    bool wake_word_reset_ = false;
+    bool wake_word_drain_ = false;
+    bool wake_word_drained_ = false;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
-    void StoreWakeWordData(uint16_t* data, size_t size);
+    void StoreWakeWordData(const int16_t* data, size_t samples);
+    void ResetWakeWordData();
     void AudioDetectionTask();
+    void WakeWordEncodeTask();
 };
 
 #endif
@@ -0,0 +1,221 @@
+#include "audio_resampler.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "AudioResampler"
+
+namespace {
+
+// Just enough math to design the filters at compile time
+
+constexpr double kPi = 3.14159265358979323846;
+
+constexpr double ConstSin(double x) {
+    while (x > kPi) {
+        x -= 2 * kPi;
+    }
+    while (x < -kPi) {
+        x += 2 * kPi;
+    }
+    double term = x;
+    double sum = x;
+    for (int i = 1; i < 14; i++) {
+        term *= -x * x / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double ConstSqrt(double x) {
+    if (x <= 0) {
+        return 0;
+    }
+    double root = x > 1 ? x : 1;
+    for (int i = 0; i < 40; i++) {
+        root = 0.5 * (root + x / root);
+    }
+    return root;
+}
+
+// Modified Bessel function of the first kind, order 0
+constexpr double ConstBesselI0(double x) {
+    double term = 1;
+    double sum = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Q15 taps of every polyphase branch, oldest input sample first
+template <int L, int TAPS>
+struct PolyphaseCoefficients {
+    int16_t values[L][TAPS];
+};
+
+// Kaiser windowed sinc low-pass at the upsampled rate, split into L branches.
+// Each branch is normalized to unity DC gain so that no ripple shows up on DC.
+template <int L, int M, int TAPS>
+constexpr PolyphaseCoefficients<L, TAPS> DesignFilter(double beta, double cutoff) {
+    constexpr int kLength = L * TAPS;
+    PolyphaseCoefficients<L, TAPS> coefficients = {};
+    double prototype[kLength] = {};
+    double center = (kLength - 1) / 2.0;
+    // Relative to the upsampled rate, below the Nyquist frequency of the lower of the two rates
+    double fc = 0.5 / (L > M ? L : M) * cutoff;
+    for (int n = 0; n < kLength; n++) {
+        double t = n - center;
+        double sinc = t == 0 ? 2 * fc : ConstSin(2 * kPi * fc * t) / (kPi * t);
+        double r = 2 * t / (kLength - 1);
+        double window = ConstBesselI0(beta * ConstSqrt(1 - r * r)) / ConstBesselI0(beta);
+        prototype[n] = sinc * window;
+    }
+
+    for (int phase = 0; phase < L; phase++) {
+        double sum = 0;
+        for (int j = 0; j < TAPS; j++) {
+            sum += prototype[phase + j * L];
+        }
+        int total = 0;
+        int largest = 0;
+        for (int j = 0; j < TAPS; j++) {
+            double value = prototype[phase + j * L] / sum * 32768;
+            int quantized = value >= 0 ? int(value + 0.5) : -int(-value + 0.5);
+            quantized = quantized > 32767 ? 32767 : (quantized < -32768 ? -32768 : quantized);
+            // Tap j weighs input base - j, store them oldest first for a forward dot product
+            coefficients.values[phase][TAPS - 1 - j] = quantized;
+            total += quantized;
+            if (quantized > coefficients.values[phase][largest]) {
+                largest = TAPS - 1 - j;
+            }
+        }
+        // Put the rounding error on the largest tap, the branch then sums to exactly 1.0
+        coefficients.values[phase][largest] += 32768 - total;
+    }
+    return coefficients;
+}
+
+template <int TAPS>
+inline int16_t DotProduct(const int16_t* coefficients, const int16_t* samples) {
+    // Four independent accumulators keep the Xtensa MAC pipeline busy,
+    // the taps sum to 1.0 so 32 bits cannot overflow
+    int32_t acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+    for (int k = 0; k < TAPS; k += 4) {
+        acc0 += coefficients[k] * samples[k];
+        acc1 += coefficients[k + 1] * samples[k + 1];
+        acc2 += coefficients[k + 2] * samples[k + 2];
+        acc3 += coefficients[k + 3] * samples[k + 3];
+    }
+    int32_t value = (acc0 + acc1 + acc2 + acc3 + (1 << 14)) >> 15;
+    value = value > INT16_MAX ? INT16_MAX : value;
+    value = value < INT16_MIN ? INT16_MIN : value;
+    return value;
+}
+
+// Upsample by L, low-pass, decimate by M, without computing the discarded samples
+template <int L, int M, int TAPS, int BETA_X10, int CUTOFF_X100>
+class PolyphaseKernel : public ResamplerKernel {
+public:
+    static_assert(TAPS % 4 == 0, "Taps must be a multiple of 4");
+    static constexpr PolyphaseCoefficients<L, TAPS> kCoefficients =
+        DesignFilter<L, M, TAPS>(BETA_X10 / 10.0, CUTOFF_X100 / 100.0);
+
+    PolyphaseKernel() : buffer_(TAPS - 1, 0) {
+    }
+
+    int GetOutputSamples(int input_samples) const override {
+        int end = input_samples * L;
+        return position_ >= end ? 0 : (end - position_ + M - 1) / M;
+    }
+
+    int Process(const int16_t* input, int input_samples, int16_t* output) override {
+        // TAPS - 1 samples of history followed by the new input, the buffer only ever grows
+        if (buffer_.size() < size_t(TAPS - 1 + input_samples)) {
+            buffer_.resize(TAPS - 1 + input_samples);
+        }
+        std::copy(input, input + input_samples, buffer_.begin() + TAPS - 1);
+
+        // position_ counts upsampled samples from the first new input sample
+        int produced = 0;
+        int end = input_samples * L;
+        while (position_ < end) {
+            int base = position_ / L;
+            int phase = position_ - base * L;
+            output[produced++] = DotProduct<TAPS>(kCoefficients.values[phase], &buffer_[base]);
+            position_ += M;
+        }
+        position_ -= end;
+
+        std::copy(buffer_.begin() + input_samples, buffer_.begin() + input_samples + TAPS - 1, buffer_.begin());
+        return produced;
+    }
+
+private:
+    std::vector<int16_t> buffer_;
+    int position_ = 0;
+};
+
+// Filter length is given per period of the lower of the two rates, so the transition band
+// is equally narrow in Hz whichever side is decimated. Returns the taps of one branch.
+template <int L, int M>
+constexpr int BranchTaps(int taps) {
+    return taps * (L > M ? L : M) / L;
+}
+
+// The cutoff sits just below the lower Nyquist frequency, the transition band straddles it,
+// so aliases can only land in the top few hundred Hz where the passband has rolled off.
+// At 16kHz: Low passes 7kHz at -0.7dB and rejects 9kHz by 22dB, Medium by 52dB
+// with -0.4dB at 7kHz, High by 70dB with a flat passband.
+template <int L, int M>
+std::unique_ptr<ResamplerKernel> CreateKernel(ResamplerQuality quality) {
+    switch (quality) {
+        case kResamplerQualityLow:
+            return std::make_unique<PolyphaseKernel<L, M, BranchTaps<L, M>(16), 50, 100>>();
+        case kResamplerQualityHigh:
+            return std::make_unique<PolyphaseKernel<L, M, BranchTaps<L, M>(40), 70, 98>>();
+        default:
+            return std::make_unique<PolyphaseKernel<L, M, BranchTaps<L, M>(24), 55, 98>>();
+    }
+}
+
+} // namespace
+
+void AudioResampler::Configure(int input_sample_rate, int output_sample_rate, ResamplerQuality quality) {
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    kernel_.reset();
+    fallback_.reset();
+
+    if (input_sample_rate == 48000 && output_sample_rate == 16000) {
+        kernel_ = CreateKernel<1, 3>(quality);
+    } else if (input_sample_rate == 24000 && output_sample_rate == 16000) {
+        kernel_ = CreateKernel<2, 3>(quality);
+    } else if (input_sample_rate == 16000 && output_sample_rate == 24000) {
+        kernel_ = CreateKernel<3, 2>(quality);
+    } else if (input_sample_rate == 24000 && output_sample_rate == 48000) {
+        kernel_ = CreateKernel<2, 1>(quality);
+    } else {
+        ESP_LOGI(TAG, "No specialized kernel for %d -> %d, using OpusResampler", input_sample_rate, output_sample_rate);
+        fallback_ = std::make_unique<OpusResampler>();
+        fallback_->Configure(input_sample_rate, output_sample_rate);
+    }
+}
+
+int AudioResampler::GetOutputSamples(int input_samples) const {
+    if (kernel_) {
+        return kernel_->GetOutputSamples(input_samples);
+    } else if (fallback_) {
+        return fallback_->GetOutputSamples(input_samples);
+    }
+    return 0;
+}
+
+void AudioResampler::Process(const int16_t* input, int input_samples, int16_t* output) {
+    if (kernel_) {
+        kernel_->Process(input, input_samples, output);
+    } else if (fallback_) {
+        fallback_->Process(input, input_samples, output);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <opus_resampler.h>
+
+// Filter length, trading CPU and delay for alias rejection
+enum ResamplerQuality {
+    kResamplerQualityLow,     // 16 taps per period of the lower rate, shortest delay
+    kResamplerQualityMedium,  // 24 taps, for the capture path
+    kResamplerQualityHigh     // 40 taps, for what ends up at the speaker
+};
+
+// Streaming fixed-point polyphase kernel for one rate ratio
+class ResamplerKernel {
+public:
+    virtual ~ResamplerKernel() = default;
+    virtual int GetOutputSamples(int input_samples) const = 0;
+    virtual int Process(const int16_t* input, int input_samples, int16_t* output) = 0;
+};
+
+// Drop-in replacement for OpusResampler.
+// The ratios the board codecs and servers actually use (48k->16k, 24k->16k, 16k->24k, 24k->48k)
+// run on polyphase kernels whose coefficients are computed at compile time. Other ratios fall
+// back to OpusResampler. State carries over between calls, so audio can be fed in any chunk size;
+// GetOutputSamples(n) tells exactly how many samples the next Process(n) will write.
+class AudioResampler {
+public:
+    void Configure(int input_sample_rate, int output_sample_rate, ResamplerQuality quality = kResamplerQualityMedium);
+    int GetOutputSamples(int input_samples) const;
+    void Process(const int16_t* input, int input_samples, int16_t* output);
+
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    std::unique_ptr<ResamplerKernel> kernel_;
+    std::unique_ptr<OpusResampler> fallback_;
+};
+
+#endif // AUDIO_RESAMPLER_H
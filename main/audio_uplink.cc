@@ -0,0 +1,296 @@
+#include "audio_uplink.h"
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "AudioUplink"
+
+#define UPLINK_PCM_READY_EVENT (1 << 0)
+#define UPLINK_OPUS_READY_EVENT (1 << 1)
+
+#define UPLINK_ENCODE_TASK_STACK_SIZE (4096 * 8)
+
+AudioUplink::AudioUplink() : pcm_queue_(AUDIO_UPLINK_MAX_PCM_SAMPLES * sizeof(int16_t)) {
+    event_group_ = xEventGroupCreate();
+}
+
+AudioUplink::~AudioUplink() {
+    if (encode_task_ != nullptr) {
+        vTaskDelete(encode_task_);
+    }
+    if (send_task_ != nullptr) {
+        vTaskDelete(send_task_);
+    }
+    if (encode_task_stack_ != nullptr) {
+        heap_caps_free(encode_task_stack_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+void AudioUplink::Start(UplinkEncoder* encoder, int frame_duration_ms, BackgroundTask* background_task,
+    std::function<void(const std::vector<uint8_t>& opus, int64_t capture_time)> send) {
+    frame_duration_ms_ = frame_duration_ms;
+    hold_frames_ = (AUDIO_UPLINK_HOLD_MS + frame_duration_ms - 1) / frame_duration_ms;
+    send_ = send;
+
+    // At a speech onset the whole pre-roll and the onset frame go to the Opus queue at once,
+    // it has to hold them all or the drop policy clips the onset
+    const int min_duration = std::min(frame_duration_ms, AUDIO_UPLINK_MIN_FRAME_DURATION_MS);
+    size_t preroll_frames = 0;
+    size_t opus_queue_size = AUDIO_UPLINK_OPUS_QUEUE_SIZE;
+    if (silence_mode_ != kUplinkSilenceOff) {
+        preroll_frames = (UPLINK_SILENCE_PREROLL_MS + min_duration - 1) / min_duration;
+        opus_queue_size = std::max(opus_queue_size, preroll_frames + 1);
+    }
+
+    // Without its queues the uplink stays disabled instead of taking the device down
+    bool allocated = pcm_queue_.Allocate(AUDIO_UPLINK_PCM_QUEUE_SIZE) &&
+        opus_queue_.Allocate(opus_queue_size) &&
+        hold_queue_.Allocate((AUDIO_UPLINK_HOLD_MS + min_duration - 1) / min_duration);
+    if (allocated && preroll_frames > 0) {
+        allocated = preroll_.Allocate(preroll_frames);
+        preroll_packet_.reserve(preroll_.max_packet_size());
+    }
+    if (!allocated) {
+        ESP_LOGE(TAG, "Failed to allocate the uplink queues, audio will not be sent");
+        return;
+    }
+    // Popped into with its full size, never handed away
+    encode_pcm_.resize(AUDIO_UPLINK_MAX_PCM_SAMPLES);
+
+#if CONFIG_SPIRAM
+    // Opus needs a deep stack, keep it out of internal RAM when PSRAM is available
+    encode_task_stack_ = (StackType_t*)heap_caps_malloc(UPLINK_ENCODE_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+    if (encode_task_stack_ == nullptr) {
+        encode_task_stack_ = (StackType_t*)heap_caps_malloc(UPLINK_ENCODE_TASK_STACK_SIZE, MALLOC_CAP_INTERNAL);
+    }
+    if (encode_task_stack_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the encoder stack, audio will not be sent");
+        return;
+    }
+    encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto uplink = (AudioUplink*)arg;
+        uplink->EncodeTask();
+    }, "audio_encode", UPLINK_ENCODE_TASK_STACK_SIZE, this, 2, encode_task_stack_, &encode_task_buffer_);
+#else
+    background_task_ = background_task;
+#endif
+
+    xTaskCreate([](void* arg) {
+        auto uplink = (AudioUplink*)arg;
+        uplink->SendTask();
+    }, "audio_send", 4096 * 2, this, 4, &send_task_);
+    // Set last, PushPcm() ignores frames until the uplink is ready
+    encoder_ = encoder;
+}
+
+void AudioUplink::SetFrameDuration(UplinkEncoder* encoder, int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(encoder_mutex_);
+    if (encoder_ == nullptr) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink frame duration: %d ms", frame_duration_ms);
+    encoder_ = encoder;
+    frame_duration_ms_ = frame_duration_ms;
+    hold_frames_ = (AUDIO_UPLINK_HOLD_MS + frame_duration_ms - 1) / frame_duration_ms;
+    // The server decodes with the new duration, what was encoded with the old one is dropped
+    opus_dropped_ += opus_queue_.Size() + hold_queue_.Size();
+    opus_queue_.Clear();
+    hold_queue_.Clear();
+    reset_encoder_ = false;
+    reset_silence_ = false;
+    ResetSilence();
+}
+
+bool AudioUplink::Enqueue(PacketRing& queue, const void* data, size_t size, int64_t timestamp, std::atomic<uint32_t>& dropped,
+    size_t max_packets) {
+    if (size > queue.max_packet_size()) {
+        // It would never fit, the drop policy must not discard a queued frame for it
+        ESP_LOGW(TAG, "Frame too large for the queue: %zu > %zu", size, queue.max_packet_size());
+        dropped++;
+        return false;
+    }
+    if (queue.Size() < max_packets && queue.Push((const uint8_t*)data, size, timestamp)) {
+        return true;
+    }
+    dropped++;
+    if (drop_policy_ == kUplinkDropOldest && queue.DropOldest()) {
+        return queue.Push((const uint8_t*)data, size, timestamp);
+    }
+    return false;
+}
+
+bool AudioUplink::PushPcm(const int16_t* data, size_t samples, int64_t capture_time) {
+    if (encoder_ == nullptr) {
+        return false;
+    }
+    pcm_frames_++;
+    if (!Enqueue(pcm_queue_, data, samples * sizeof(int16_t), capture_time, pcm_dropped_)) {
+        return false;
+    }
+    if (background_task_ == nullptr) {
+        xEventGroupSetBits(event_group_, UPLINK_PCM_READY_EVENT);
+    } else if (!encode_scheduled_.exchange(true)) {
+        background_task_->Schedule([this]() {
+            // Cleared first, a frame pushed while encoding schedules another pass
+            encode_scheduled_ = false;
+            EncodePending();
+        });
+    }
+    return true;
+}
+
+void AudioUplink::Flush() {
+    pcm_queue_.Clear();
+    opus_queue_.Clear();
+    hold_queue_.Clear();
+    // The encoder task owns the encoder and the pre-roll, let it start over on the next frame
+    reset_encoder_ = true;
+    reset_silence_ = true;
+}
+
+void AudioUplink::Hold() {
+    held_ = true;
+}
+
+void AudioUplink::Release() {
+    held_ = false;
+    xEventGroupSetBits(event_group_, UPLINK_OPUS_READY_EVENT);
+}
+
+AudioUplinkStats AudioUplink::GetStats() const {
+    AudioUplinkStats stats;
+    stats.pcm_frames = pcm_frames_;
+    stats.pcm_dropped = pcm_dropped_;
+    stats.opus_packets = opus_packets_;
+    stats.opus_dropped = opus_dropped_;
+    stats.sent = sent_;
+    stats.suppressed = suppressed_;
+    stats.encode_us = encode_us_;
+    stats.send_us = send_us_;
+    return stats;
+}
+
+bool AudioUplink::IsSilence(const std::vector<uint8_t>& opus) const {
+    switch (silence_mode_) {
+        case kUplinkSilenceVad:
+            return !voice_active_;
+        case kUplinkSilenceDtx:
+            return opus.size() <= UPLINK_DTX_PACKET_SIZE;
+        default:
+            return false;
+    }
+}
+
+void AudioUplink::ResetSilence() {
+    preroll_.Clear();
+    suppressing_ = false;
+    silence_ms_ = 0;
+    keepalive_ms_ = 0;
+}
+
+void AudioUplink::OnEncoded(const std::vector<uint8_t>& opus, int64_t capture_time) {
+    if (reset_silence_.exchange(false)) {
+        ResetSilence();
+    }
+
+    bool held = held_;
+    auto& queue = held ? hold_queue_ : opus_queue_;
+    // The hold queue keeps AUDIO_UPLINK_HOLD_MS whatever the frame duration
+    size_t max_packets = held ? hold_frames_ : SIZE_MAX;
+    if (!IsSilence(opus)) {
+        if (suppressing_) {
+            // Speech onset, send what was held back right before it
+            int64_t packet_time;
+            while (preroll_.Pop(preroll_packet_, &packet_time)) {
+                Enqueue(queue, preroll_packet_.data(), preroll_packet_.size(), packet_time, opus_dropped_, max_packets);
+            }
+            suppressing_ = false;
+        }
+        silence_ms_ = 0;
+    } else {
+        silence_ms_ += frame_duration_ms_;
+        if (silence_ms_ > UPLINK_SILENCE_HANGOVER_MS) {
+            if (!suppressing_) {
+                suppressing_ = true;
+                keepalive_ms_ = 0;
+            }
+            keepalive_ms_ += frame_duration_ms_;
+            if (keepalive_ms_ < UPLINK_SILENCE_KEEPALIVE_MS) {
+                // Only what falls out of the pre-roll is really suppressed
+                if (preroll_.Size() * frame_duration_ms_ >= UPLINK_SILENCE_PREROLL_MS && preroll_.DropOldest()) {
+                    suppressed_++;
+                }
+                preroll_.Push(opus.data(), opus.size(), capture_time);
+                return;
+            }
+            keepalive_ms_ = 0;
+        }
+    }
+
+    if (Enqueue(queue, opus.data(), opus.size(), capture_time, opus_dropped_, max_packets) && !held_) {
+        // Also wakes the sender for a packet that went to the hold queue just before Release()
+        xEventGroupSetBits(event_group_, UPLINK_OPUS_READY_EVENT);
+    }
+}
+
+void AudioUplink::EncodePending() {
+    size_t size;
+    int64_t capture_time;
+    auto& tracer = LatencyTracer::GetInstance();
+    while (pcm_queue_.Pop(encode_pcm_.data(), size, &capture_time)) {
+        std::lock_guard<std::mutex> lock(encoder_mutex_);
+        auto encoder = encoder_.load();
+        if (reset_encoder_.exchange(false)) {
+            encoder->ResetState();
+        }
+        int complexity = pending_complexity_.exchange(-1);
+        if (complexity >= 0) {
+            encoder->SetComplexity(complexity);
+        }
+        int bitrate = pending_bitrate_.exchange(-1);
+        if (bitrate >= 0) {
+            encoder->SetBitrate(bitrate);
+        }
+        int64_t start_time = esp_timer_get_time();
+        // Encode() takes ownership of its input, an exact-size copy keeps the pop buffer intact.
+        // The encoder buffers up to a full Opus frame, the packet is stamped with the newest PCM it holds
+        std::vector<int16_t> pcm(encode_pcm_.begin(), encode_pcm_.begin() + size / sizeof(int16_t));
+        encoder->Encode(std::move(pcm), [this, &tracer, capture_time](std::vector<uint8_t>&& opus) {
+            opus_packets_++;
+            tracer.Record(kLatencyCaptureToEncoded, capture_time);
+            OnEncoded(opus, capture_time);
+        });
+        encode_us_ += esp_timer_get_time() - start_time;
+    }
+}
+
+void AudioUplink::EncodeTask() {
+    while (true) {
+        xEventGroupWaitBits(event_group_, UPLINK_PCM_READY_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+        EncodePending();
+    }
+}
+
+void AudioUplink::SendTask() {
+    std::vector<uint8_t> opus;
+    opus.reserve(opus_queue_.max_packet_size());
+    int64_t capture_time;
+    auto& tracer = LatencyTracer::GetInstance();
+    while (true) {
+        xEventGroupWaitBits(event_group_, UPLINK_OPUS_READY_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        // A blocking send is the backpressure: packets wait in the Opus queue meanwhile.
+        // Held packets are older than anything in the Opus queue and go first.
+        while ((!held_ && hold_queue_.Pop(opus, &capture_time)) || opus_queue_.Pop(opus, &capture_time)) {
+            int64_t start_time = esp_timer_get_time();
+            send_(opus, capture_time);
+            send_us_ += esp_timer_get_time() - start_time;
+            sent_++;
+            tracer.Record(kLatencyCaptureToSent, capture_time);
+        }
+    }
+}
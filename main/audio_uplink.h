@@ -0,0 +1,161 @@
+#ifndef AUDIO_UPLINK_H
+#define AUDIO_UPLINK_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "packet_ring.h"
+#include "uplink_encoder.h"
+#include "background_task.h"
+
+#define AUDIO_UPLINK_MAX_PCM_SAMPLES 1024
+#define AUDIO_UPLINK_PCM_QUEUE_SIZE 4
+#define AUDIO_UPLINK_OPUS_QUEUE_SIZE 8
+// The queues are sized for the shortest frame duration the server may ask for
+#define AUDIO_UPLINK_MIN_FRAME_DURATION_MS 20
+// Audio held back while the channel opens, kept short when it has to live in internal RAM
+#if CONFIG_SPIRAM
+#define AUDIO_UPLINK_HOLD_MS 2000
+#else
+#define AUDIO_UPLINK_HOLD_MS 600
+#endif
+
+// Silence suppression timing
+#define UPLINK_SILENCE_PREROLL_MS 300     // Sent ahead of a speech onset so it is not clipped
+#define UPLINK_SILENCE_HANGOVER_MS 600    // Keep sending this long after speech ends
+#define UPLINK_SILENCE_KEEPALIVE_MS 1000  // One frame per interval while suppressed
+// Opus DTX emits packets of at most this size for silence
+#define UPLINK_DTX_PACKET_SIZE 2
+
+// What to do when a stage cannot keep up and its queue is full
+enum UplinkDropPolicy {
+    kUplinkDropNewest,  // Keep what is queued, discard the incoming frame
+    kUplinkDropOldest   // Discard the oldest queued frame to make room, favours latency
+};
+
+// How the uplink decides a frame is silence while listening
+enum UplinkSilenceMode {
+    kUplinkSilenceOff,  // Send every frame
+    kUplinkSilenceVad,  // Follow the VAD state passed to SetVoiceActive()
+    kUplinkSilenceDtx   // Follow the encoder, tiny DTX packets are silence (requires SetDtx)
+};
+
+struct AudioUplinkStats {
+    uint32_t pcm_frames = 0;
+    uint32_t pcm_dropped = 0;
+    uint32_t opus_packets = 0;
+    uint32_t opus_dropped = 0;
+    uint32_t sent = 0;
+    uint32_t suppressed = 0;
+    // Running totals, they wrap around so only differences are meaningful
+    uint32_t encode_us = 0;
+    uint32_t send_us = 0;
+};
+
+// Captured PCM -> [PCM queue] -> encoder task -> [Opus queue] -> sender task -> transport
+//
+// The encoder and the transport each get their own task, so a slow network send
+// only fills the Opus queue instead of stalling capture or the main event loop.
+// When a queue overflows the configured drop policy applies and is counted.
+//
+// With silence suppression, encoded silence goes to a short pre-roll instead of the Opus
+// queue once the hangover has passed, and only a keepalive frame is sent now and then.
+// When speech resumes the pre-roll is sent first, so the onset is not clipped.
+//
+// While held, encoded packets collect in a separate queue instead of being sent, so capture
+// can start before the audio channel is open. Release() sends them ahead of anything newer.
+//
+// The queues are allocated by Start() for the shortest frame duration, so SetFrameDuration()
+// can switch the encoder per session without reallocating them. Without PSRAM there is
+// no room for a second deep Opus stack, so encoding runs on `background_task` instead.
+class AudioUplink {
+public:
+    AudioUplink();
+    ~AudioUplink();
+
+    // Call SetSilenceMode() first, the pre-roll is only allocated when suppression is on
+    void Start(UplinkEncoder* encoder, int frame_duration_ms, BackgroundTask* background_task,
+        std::function<void(const std::vector<uint8_t>& opus, int64_t capture_time)> send);
+    void SetDropPolicy(UplinkDropPolicy policy) { drop_policy_ = policy; }
+    void SetSilenceMode(UplinkSilenceMode mode) { silence_mode_ = mode; }
+    // Applied by the encoder task before its next frame
+    void SetComplexity(int complexity) { pending_complexity_ = complexity; }
+    void SetBitrate(int bitrate) { pending_bitrate_ = bitrate; }
+    // Called from the VAD, may be any task
+    void SetVoiceActive(bool active) { voice_active_ = active; }
+    // Switches to an encoder of another frame duration, e.g. the one the server accepted.
+    // Packets already encoded are discarded, the caller may free the previous encoder afterwards.
+    void SetFrameDuration(UplinkEncoder* encoder, int frame_duration_ms);
+    // Called from the capture side, never blocks. `capture_time` is used for latency tracing.
+    bool PushPcm(const int16_t* data, size_t samples, int64_t capture_time = 0);
+    // Discard everything still queued and the encoder state, e.g. when a new listening turn starts
+    void Flush();
+    void Hold();
+    void Release();
+    bool held() const { return held_; }
+    AudioUplinkStats GetStats() const;
+
+private:
+    EventGroupHandle_t event_group_ = nullptr;
+    // The encoder, its frame duration and the silence state below are guarded by encoder_mutex_
+    std::mutex encoder_mutex_;
+    std::atomic<UplinkEncoder*> encoder_{nullptr};
+    std::function<void(const std::vector<uint8_t>& opus, int64_t capture_time)> send_;
+    UplinkDropPolicy drop_policy_ = kUplinkDropOldest;
+    int frame_duration_ms_ = 60;
+    // AUDIO_UPLINK_HOLD_MS at the current frame duration
+    size_t hold_frames_ = 0;
+
+    PacketRing pcm_queue_;
+    PacketRing opus_queue_;
+    PacketRing hold_queue_;
+    std::atomic<bool> held_{false};
+
+    // Silence suppression, the state is owned by the encoder task
+    UplinkSilenceMode silence_mode_ = kUplinkSilenceOff;
+    std::atomic<bool> voice_active_{false};
+    std::atomic<bool> reset_silence_{false};
+    std::atomic<bool> reset_encoder_{false};
+    PacketRing preroll_;
+    std::vector<uint8_t> preroll_packet_;
+    bool suppressing_ = false;
+    int silence_ms_ = 0;
+    int keepalive_ms_ = 0;
+
+    std::atomic<uint32_t> pcm_frames_{0};
+    std::atomic<uint32_t> pcm_dropped_{0};
+    std::atomic<uint32_t> opus_packets_{0};
+    std::atomic<uint32_t> opus_dropped_{0};
+    std::atomic<uint32_t> sent_{0};
+    std::atomic<uint32_t> suppressed_{0};
+    std::atomic<uint32_t> encode_us_{0};
+    std::atomic<uint32_t> send_us_{0};
+    std::atomic<int> pending_complexity_{-1};
+    std::atomic<int> pending_bitrate_{-1};
+
+    TaskHandle_t encode_task_ = nullptr;
+    TaskHandle_t send_task_ = nullptr;
+    StaticTask_t encode_task_buffer_;
+    StackType_t* encode_task_stack_ = nullptr;
+    BackgroundTask* background_task_ = nullptr;
+    std::atomic<bool> encode_scheduled_{false};
+    std::vector<int16_t> encode_pcm_;
+
+    // The queue counts as full at `max_packets`, the drop policy applies from there
+    bool Enqueue(PacketRing& queue, const void* data, size_t size, int64_t timestamp, std::atomic<uint32_t>& dropped,
+        size_t max_packets = SIZE_MAX);
+    void ResetSilence();
+    void OnEncoded(const std::vector<uint8_t>& opus, int64_t capture_time);
+    bool IsSilence(const std::vector<uint8_t>& opus) const;
+    void EncodePending();
+    void EncodeTask();
+    void SendTask();
+};
+
+#endif // AUDIO_UPLINK_H
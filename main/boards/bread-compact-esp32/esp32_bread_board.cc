@@ -115,6 +115,10 @@ private:
             gpio_set_level(BUILTIN_LED_GPIO, 1);
             app.ToggleChatState();
         });
+        boot_button_.OnPressDown([this]() {
+            // The click only fires on release, start the handshake already
+            Application::GetInstance().PrepareAudioChannel();
+        });
 
         asr_button_.OnClick([this]() {
             std::string wake_word="你好小智";
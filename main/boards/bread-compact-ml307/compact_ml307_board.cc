@@ -98,6 +98,10 @@ private:
         boot_button_.OnClick([this]() {
             Application::GetInstance().ToggleChatState();
         });
+        boot_button_.OnPressDown([this]() {
+            // The click only fires on release, start the handshake already
+            Application::GetInstance().PrepareAudioChannel();
+        });
         touch_button_.OnPressDown([this]() {
             Application::GetInstance().StartListening();
         });
@@ -111,6 +111,10 @@ private:
             }
             app.ToggleChatState();
         });
+        boot_button_.OnPressDown([this]() {
+            // The click only fires on release, start the handshake already
+            Application::GetInstance().PrepareAudioChannel();
+        });
         touch_button_.OnPressDown([this]() {
             Application::GetInstance().StartListening();
         });
@@ -48,6 +48,10 @@ bool Board::GetBatteryLevel(int &level, bool& charging, bool& discharging) {
     return false;
 }
 
+int Board::GetSignalQuality() {
+    return -1;
+}
+
 Display* Board::GetDisplay() {
     static NoDisplay display;
     return &display;
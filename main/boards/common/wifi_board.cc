@@ -5,6 +5,7 @@
 #include "system_info.h"
 #include "font_awesome_symbols.h"
 #include "settings.h"
+#include "resumable_tls_transport.h"
 #include "assets/lang_config.h"
 
 #include <freertos/FreeRTOS.h>
@@ -13,7 +14,6 @@
 #include <esp_mqtt.h>
 #include <esp_udp.h>
 #include <tcp_transport.h>
-#include <tls_transport.h>
 #include <web_socket.h>
 #include <esp_log.h>
 
@@ -117,7 +117,7 @@ WebSocket* WifiBoard::CreateWebSocket() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     if (url.find("wss://") == 0) {
-        return new WebSocket(new TlsTransport());
+        return new WebSocket(new ResumableTlsTransport());
     } else {
         return new WebSocket(new TcpTransport());
     }
@@ -150,6 +150,17 @@ const char* WifiBoard::GetNetworkStateIcon() {
     }
 }
 
+int WifiBoard::GetSignalQuality() {
+    auto& wifi_station = WifiStation::GetInstance();
+    if (wifi_config_mode_ || !wifi_station.IsConnected()) {
+        return -1;
+    }
+    // -90 dBm and below is unusable, -50 dBm and above is as good as it gets
+    int rssi = wifi_station.GetRssi();
+    int quality = (rssi + 90) * 100 / 40;
+    return quality < 0 ? 0 : (quality > 100 ? 100 : quality);
+}
+
 std::string WifiBoard::GetBoardJson() {
     // Set the board type for OTA
     auto& wifi_station = WifiStation::GetInstance();
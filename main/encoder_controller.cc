@@ -0,0 +1,92 @@
+#include "encoder_controller.h"
+
+#include <esp_log.h>
+
+#define TAG "EncoderController"
+
+// Share of real time spent encoding
+#define ENCODER_CPU_LOAD_HIGH 50
+#define ENCODER_CPU_LOAD_LOW 25
+// Share of real time spent in the transport send
+#define ENCODER_SEND_LOAD_HIGH 50
+#define ENCODER_SEND_LOAD_LOW 20
+// Board::GetSignalQuality() thresholds
+#define ENCODER_SIGNAL_WEAK 30
+#define ENCODER_SIGNAL_STRONG 60
+// Backing off is faster than recovering
+#define ENCODER_BITRATE_STEP_DOWN 4000
+#define ENCODER_BITRATE_STEP_UP 2000
+
+void EncoderController::Initialize(int complexity, int bitrate) {
+    initial_complexity_ = complexity;
+    complexity_ = complexity;
+    initial_bitrate_ = bitrate;
+    bitrate_ = bitrate;
+}
+
+void EncoderController::Reset() {
+    complexity_ = initial_complexity_;
+    bitrate_ = initial_bitrate_;
+}
+
+bool EncoderController::Update(const EncoderSignals& signals) {
+    if (signals.frames == 0) {
+        // Not encoding, nothing to learn from
+        return false;
+    }
+    int complexity = UpdateComplexity(signals);
+    int bitrate = UpdateBitrate(signals);
+    if (complexity == complexity_ && bitrate == bitrate_) {
+        return false;
+    }
+    complexity_ = complexity;
+    bitrate_ = bitrate;
+    return true;
+}
+
+int EncoderController::UpdateComplexity(const EncoderSignals& signals) {
+    uint32_t audio_us = signals.frames * signals.frame_duration_ms * 1000;
+    int cpu_load = (uint64_t)signals.encode_us * 100 / audio_us;
+
+    int complexity = complexity_;
+    if (cpu_load >= ENCODER_CPU_LOAD_HIGH || signals.dropped > 0) {
+        complexity--;
+    } else if (cpu_load < ENCODER_CPU_LOAD_LOW && complexity < initial_complexity_) {
+        complexity++;
+    }
+    if (complexity < ENCODER_MIN_COMPLEXITY) {
+        complexity = ENCODER_MIN_COMPLEXITY;
+    }
+    if (complexity != complexity_) {
+        ESP_LOGI(TAG, "Complexity %d -> %d (cpu %d%%, dropped %lu)", complexity_, complexity, cpu_load, signals.dropped);
+    }
+    return complexity;
+}
+
+int EncoderController::UpdateBitrate(const EncoderSignals& signals) {
+    // Suppressed silence is not sent, so the load is measured against the audio actually sent
+    int send_load = 0;
+    if (signals.sent > 0) {
+        send_load = (uint64_t)signals.send_us * 100 / ((uint64_t)signals.sent * signals.frame_duration_ms * 1000);
+    }
+    bool weak = signals.signal_quality >= 0 && signals.signal_quality < ENCODER_SIGNAL_WEAK;
+    // Unknown quality does not hold the bitrate back, the send time still does
+    bool strong = signals.signal_quality < 0 || signals.signal_quality >= ENCODER_SIGNAL_STRONG;
+
+    int bitrate = bitrate_;
+    if (signals.link_dropped > 0 || send_load >= ENCODER_SEND_LOAD_HIGH || weak) {
+        bitrate -= ENCODER_BITRATE_STEP_DOWN;
+    } else if (strong && send_load < ENCODER_SEND_LOAD_LOW) {
+        bitrate += ENCODER_BITRATE_STEP_UP;
+    }
+    if (bitrate < ENCODER_MIN_BITRATE) {
+        bitrate = ENCODER_MIN_BITRATE;
+    } else if (bitrate > initial_bitrate_) {
+        bitrate = initial_bitrate_;
+    }
+    if (bitrate != bitrate_) {
+        ESP_LOGI(TAG, "Bitrate %d -> %d (signal %d, send %d%%, dropped %lu)", bitrate_, bitrate,
+            signals.signal_quality, send_load, signals.link_dropped);
+    }
+    return bitrate;
+}
@@ -0,0 +1,53 @@
+#ifndef ENCODER_CONTROLLER_H
+#define ENCODER_CONTROLLER_H
+
+#include <cstdint>
+
+#define ENCODER_MIN_COMPLEXITY 0
+// Uplink bitrate range in bits per second. The ceiling is about what Opus picks on its own
+// for 16kHz speech, the floor still keeps speech wideband.
+#define ENCODER_MAX_BITRATE 16000
+#define ENCODER_MIN_BITRATE 8000
+
+// What the encoder and the link looked like during the last control window
+struct EncoderSignals {
+    int frame_duration_ms = 60;
+    uint32_t frames = 0;        // Opus packets encoded
+    uint32_t encode_us = 0;     // Time spent encoding them
+    uint32_t dropped = 0;       // PCM frames dropped because the encoder could not keep up
+    uint32_t sent = 0;          // Opus packets handed to the transport
+    uint32_t send_us = 0;       // Time spent sending them
+    uint32_t link_dropped = 0;  // Opus packets dropped because the sender could not keep up
+    int signal_quality = -1;    // Board::GetSignalQuality()
+};
+
+// Picks the Opus complexity and bitrate for the next window.
+//
+// Complexity follows the CPU: the board's choice is the ceiling, since raising it does not
+// save any bits. When the encoder runs short of CPU it steps down, and once the load has
+// eased it steps back up towards the board's choice.
+//
+// Bitrate follows the link: a weak signal, slow sends or packets dropped in front of the
+// transport step it down, a strong idle link steps it back up towards the starting bitrate.
+// One step per window keeps either from oscillating.
+class EncoderController {
+public:
+    // Sets the starting point of every session
+    void Initialize(int complexity, int bitrate = ENCODER_MAX_BITRATE);
+    void Reset();
+    // Returns true if the complexity or the bitrate changed
+    bool Update(const EncoderSignals& signals);
+    int complexity() const { return complexity_; }
+    int bitrate() const { return bitrate_; }
+
+private:
+    int initial_complexity_ = 3;
+    int complexity_ = 3;
+    int initial_bitrate_ = ENCODER_MAX_BITRATE;
+    int bitrate_ = ENCODER_MAX_BITRATE;
+
+    int UpdateComplexity(const EncoderSignals& signals);
+    int UpdateBitrate(const EncoderSignals& signals);
+};
+
+#endif // ENCODER_CONTROLLER_H
@@ -1,6 +1,7 @@
 #include "thing_manager.h"
 
 #include <esp_log.h>
+#include <mbedtls/sha256.h>
 
 #define TAG "ThingManager"
 
@@ -8,12 +9,48 @@ namespace iot {
 
 void ThingManager::AddThing(Thing* thing) {
     things_.push_back(thing);
+    descriptors_.clear();
+    descriptors_hash_.clear();
+}
+
+const std::vector<std::string>& ThingManager::GetDescriptors() {
+    if (descriptors_.size() != things_.size()) {
+        descriptors_.clear();
+        for (auto& thing : things_) {
+            descriptors_.push_back(thing->GetDescriptorJson());
+        }
+    }
+    return descriptors_;
+}
+
+const std::string& ThingManager::GetDescriptorsHash() {
+    if (descriptors_hash_.empty() && !things_.empty()) {
+        mbedtls_sha256_context ctx;
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts(&ctx, 0);
+        for (auto& descriptor : GetDescriptors()) {
+            // Separate the descriptors so that moving text between them changes the digest
+            mbedtls_sha256_update(&ctx, (const unsigned char*)descriptor.c_str(), descriptor.size() + 1);
+        }
+        unsigned char digest[32];
+        mbedtls_sha256_finish(&ctx, digest);
+        mbedtls_sha256_free(&ctx);
+
+        // The first 128 bits are plenty to tell two sets of descriptors apart
+        static const char hex_chars[] = "0123456789abcdef";
+        for (int i = 0; i < 16; i++) {
+            descriptors_hash_ += hex_chars[digest[i] >> 4];
+            descriptors_hash_ += hex_chars[digest[i] & 0x0f];
+        }
+        ESP_LOGI(TAG, "Descriptors of %zu things, hash %s", things_.size(), descriptors_hash_.c_str());
+    }
+    return descriptors_hash_;
 }
 
 std::string ThingManager::GetDescriptorsJson() {
     std::string json_str = "[";
-    for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+    for (auto& descriptor : GetDescriptors()) {
+        json_str += descriptor + ",";
     }
     if (json_str.back() == ',') {
         json_str.pop_back();
@@ -25,6 +25,10 @@ public:
     void AddThing(Thing* thing);
 
     std::string GetDescriptorsJson();
+    // One descriptor per thing, serialized once and kept until a thing is added
+    const std::vector<std::string>& GetDescriptors();
+    // Digest of the descriptors, the server may already have this exact set
+    const std::string& GetDescriptorsHash();
     bool GetStatesJson(std::string& json, bool delta = false);
     void Invoke(const cJSON* command);
 
@@ -33,6 +37,8 @@ private:
     ~ThingManager() = default;
 
     std::vector<Thing*> things_;
+    std::vector<std::string> descriptors_;
+    std::string descriptors_hash_;
     std::map<std::string, std::string> last_states_;
 };
 
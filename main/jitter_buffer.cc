@@ -0,0 +1,256 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <cstdlib>
+
+#define TAG "JitterBuffer"
+
+// Longer arrival gaps are pauses in the stream, such as between sentences, not jitter
+#define JITTER_BUFFER_MAX_GAP_FRAMES 4
+
+static uint8_t* AllocatePayload(size_t size) {
+    auto data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == nullptr) {
+        data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return data;
+}
+
+JitterBuffer::JitterBuffer(size_t capacity)
+    : capacity_(capacity), max_depth_(capacity / 2) {
+}
+
+JitterBuffer::~JitterBuffer() {
+    for (size_t i = 0; slots_ != nullptr && i < capacity_; i++) {
+        heap_caps_free(slots_[i].large);
+    }
+    heap_caps_free(slots_);
+    heap_caps_free(slab_);
+}
+
+// Called with the buffer flushed
+void JitterBuffer::AllocateSlots(int frame_duration_ms) {
+    size_t slot_size = ((size_t)JITTER_BUFFER_SLOT_BITRATE / 8 * frame_duration_ms / 1000 + 15) & ~(size_t)15;
+    if (slot_size > OPUS_MAX_PACKET_SIZE) {
+        slot_size = OPUS_MAX_PACKET_SIZE;
+    }
+    if (slots_ == nullptr) {
+        slots_ = (Slot*)heap_caps_calloc(capacity_, sizeof(Slot), MALLOC_CAP_8BIT);
+        if (slots_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %zu slots", capacity_);
+            return;
+        }
+    }
+    if (slot_size <= slot_size_) {
+        return;
+    }
+    auto slab = AllocatePayload(capacity_ * slot_size);
+    if (slab == nullptr) {
+        // Keep the smaller slots, larger packets still fit in the per slot buffers
+        ESP_LOGE(TAG, "Failed to allocate %zu slots of %zu bytes", capacity_, slot_size);
+        return;
+    }
+    heap_caps_free(slab_);
+    slab_ = slab;
+    slot_size_ = slot_size;
+}
+
+uint8_t* JitterBuffer::SlotData(size_t index) {
+    auto& slot = slots_[index];
+    return slot.size > slot_size_ ? slot.large : slab_ + index * slot_size_;
+}
+
+void JitterBuffer::Flush() {
+    for (size_t i = 0; slots_ != nullptr && i < capacity_; i++) {
+        slots_[i].valid = false;
+    }
+    count_ = 0;
+    playing_ = false;
+    draining_ = false;
+}
+
+void JitterBuffer::Reset(int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Flush();
+    AllocateSlots(frame_duration_ms);
+    last_arrival_us_ = 0;
+    last_arrival_timestamp_ = 0;
+    // Keep the jitter estimate across utterances on the same link
+    if (frame_duration_us_ != frame_duration_ms * 1000) {
+        frame_duration_us_ = frame_duration_ms * 1000;
+        jitter_us_ = 0;
+        target_depth_ = 1;
+    }
+}
+
+// Interarrival jitter as in RFC 3550, with the send time implied by the sequence number
+void JitterBuffer::UpdateJitter(uint32_t sequence, uint32_t timestamp, int64_t now) {
+    int32_t sequence_delta = (int32_t)(sequence - last_arrival_sequence_);
+    if (last_arrival_us_ != 0 && sequence_delta > 0) {
+        int64_t expected_us = sequence_delta * frame_duration_us_;
+        if (timestamp != 0 && last_arrival_timestamp_ != 0) {
+            expected_us = (int64_t)(int32_t)(timestamp - last_arrival_timestamp_) * 1000;
+        }
+        int64_t deviation = (now - last_arrival_us_) - expected_us;
+        if (deviation <= JITTER_BUFFER_MAX_GAP_FRAMES * frame_duration_us_) {
+            jitter_us_ += (std::llabs(deviation) - jitter_us_) / 16;
+
+            size_t depth = 1 + (2 * jitter_us_ + frame_duration_us_ - 1) / frame_duration_us_;
+            if (depth > max_depth_) {
+                depth = max_depth_;
+            }
+            target_depth_ = depth;
+        }
+    }
+    if (last_arrival_us_ == 0 || sequence_delta > 0) {
+        last_arrival_us_ = now;
+        last_arrival_sequence_ = sequence;
+        last_arrival_timestamp_ = timestamp;
+    }
+}
+
+void JitterBuffer::Put(uint32_t sequence, const uint8_t* data, size_t size, uint32_t timestamp) {
+    if (size > OPUS_MAX_PACKET_SIZE) {
+        ESP_LOGW(TAG, "Packet too large: %zu > %d", size, OPUS_MAX_PACKET_SIZE);
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (slots_ == nullptr) {
+        return;
+    }
+    stats_.received++;
+    UpdateJitter(sequence, timestamp, now);
+
+    if (count_ == 0 && !playing_) {
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        buffering_since_us_ = now;
+    }
+
+    int32_t offset = (int32_t)(sequence - next_sequence_);
+    if (offset < 0) {
+        if (playing_ || (uint32_t)(highest_sequence_ - sequence) >= capacity_) {
+            // Its turn has already passed, it was concealed or skipped
+            stats_.late++;
+            return;
+        }
+        // Reordered before playback started, move the window back
+        next_sequence_ = sequence;
+        offset = 0;
+    }
+
+    if ((size_t)offset >= 2 * capacity_) {
+        // The stream jumped far ahead, start over from this packet
+        ESP_LOGW(TAG, "Sequence jumped from %lu to %lu, flushing", (unsigned long)next_sequence_, (unsigned long)sequence);
+        stats_.overflow += count_;
+        Flush();
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        offset = 0;
+    }
+    while ((size_t)offset >= capacity_) {
+        // Make room by dropping the oldest frame
+        auto& oldest = slots_[next_sequence_ % capacity_];
+        if (oldest.valid && oldest.sequence == next_sequence_) {
+            oldest.valid = false;
+            count_--;
+            stats_.overflow++;
+        }
+        next_sequence_++;
+        offset--;
+    }
+
+    auto& slot = slots_[sequence % capacity_];
+    if (slot.valid && slot.sequence == sequence) {
+        stats_.duplicate++;
+        return;
+    }
+    if (size > slot_size_ && slot.large == nullptr) {
+        slot.large = AllocatePayload(OPUS_MAX_PACKET_SIZE);
+        if (slot.large == nullptr) {
+            ESP_LOGW(TAG, "No memory for a %zu byte packet", size);
+            return;
+        }
+    }
+    if (!slot.valid) {
+        count_++;
+    }
+    if ((int32_t)(sequence - highest_sequence_) > 0) {
+        highest_sequence_ = sequence;
+    }
+    slot.valid = true;
+    slot.sequence = sequence;
+    slot.size = size;
+    slot.receive_time = now;
+    memcpy(SlotData(sequence % capacity_), data, size);
+}
+
+JitterBufferResult JitterBuffer::Get(std::vector<uint8_t>& packet, int64_t* receive_time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!playing_) {
+        if (count_ == 0) {
+            return kJitterBufferEmpty;
+        }
+        // A short reply or the tail of one may never reach the target depth, give up
+        // waiting once the target depth worth of frames should have arrived
+        int64_t waited_us = esp_timer_get_time() - buffering_since_us_;
+        if (count_ < target_depth_ && !draining_ && waited_us < (int64_t)target_depth_ * frame_duration_us_) {
+            return kJitterBufferEmpty;
+        }
+        playing_ = true;
+    }
+
+    if (count_ == 0) {
+        // Either the stream has ended or the network stalled, buffer up again
+        playing_ = false;
+        if (draining_) {
+            draining_ = false;
+        } else {
+            stats_.underrun++;
+        }
+        return kJitterBufferEmpty;
+    }
+
+    auto& slot = slots_[next_sequence_ % capacity_];
+    if (!slot.valid || slot.sequence != next_sequence_) {
+        // Later packets are here but this one is not, let the decoder conceal it
+        next_sequence_++;
+        stats_.lost++;
+        return kJitterBufferLost;
+    }
+
+    auto data = SlotData(next_sequence_ % capacity_);
+    packet.assign(data, data + slot.size);
+    if (receive_time != nullptr) {
+        *receive_time = slot.receive_time;
+    }
+    slot.valid = false;
+    count_--;
+    next_sequence_++;
+    stats_.played++;
+    return kJitterBufferPacket;
+}
+
+void JitterBuffer::Drain() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ > 0) {
+        draining_ = true;
+    }
+}
+
+size_t JitterBuffer::Size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+JitterBufferStats JitterBuffer::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.jitter_us = jitter_us_;
+    stats_.target_depth = target_depth_;
+    return stats_;
+}
@@ -0,0 +1,97 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "packet_ring.h"
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,   // Nothing to play, still buffering or the stream has ended
+    kJitterBufferPacket,  // A packet was returned
+    kJitterBufferLost     // The next packet is missing, the caller should conceal it
+};
+
+struct JitterBufferStats {
+    uint32_t received = 0;
+    uint32_t played = 0;
+    uint32_t lost = 0;
+    uint32_t late = 0;
+    uint32_t duplicate = 0;
+    uint32_t overflow = 0;
+    uint32_t underrun = 0;
+    uint32_t jitter_us = 0;
+    uint32_t target_depth = 0;
+};
+
+// Slots hold a packet of this bitrate at the negotiated frame duration, 480 bytes at 60ms
+#define JITTER_BUFFER_SLOT_BITRATE 64000
+
+// Reorders incoming downlink packets by sequence number and releases them at a
+// depth that follows the measured arrival jitter.
+//
+// Slots are allocated by the first Reset(), sized from its frame duration, and only
+// grow afterwards. A packet larger than its slot goes to a buffer of the slot's own
+// with room for any Opus packet, allocated the first time and kept. Neither the
+// network task nor the decoder allocates once the stream has settled. Packets put
+// before the first Reset() are dropped.
+class JitterBuffer {
+public:
+    explicit JitterBuffer(size_t capacity = 16);
+    ~JitterBuffer();
+    JitterBuffer(const JitterBuffer&) = delete;
+    JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+    // Drop everything and start a new stream with the given frame duration
+    void Reset(int frame_duration_ms);
+    // With the sender's `timestamp` (ms) the jitter follows the real frame spacing,
+    // otherwise every sequence step is assumed to be one frame duration
+    void Put(uint32_t sequence, const uint8_t* data, size_t size, uint32_t timestamp = 0);
+    // `receive_time` is the esp_timer time at which the packet was Put
+    JitterBufferResult Get(std::vector<uint8_t>& packet, int64_t* receive_time = nullptr);
+    // The stream has ended, release what is buffered without waiting for the target depth
+    void Drain();
+
+    size_t Size();
+    JitterBufferStats GetStats();
+
+private:
+    struct Slot {
+        bool valid;
+        uint32_t sequence;
+        uint16_t size;
+        int64_t receive_time;
+        uint8_t* large;  // OPUS_MAX_PACKET_SIZE bytes, for packets larger than slot_size_
+    };
+
+    std::mutex mutex_;
+    size_t capacity_;
+    size_t slot_size_ = 0;
+    size_t max_depth_;
+    Slot* slots_ = nullptr;
+    uint8_t* slab_ = nullptr;
+    size_t count_ = 0;
+    bool playing_ = false;
+    bool draining_ = false;
+    // When the first packet arrived while not playing
+    int64_t buffering_since_us_ = 0;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+
+    int64_t frame_duration_us_ = 60000;
+    int64_t last_arrival_us_ = 0;
+    uint32_t last_arrival_sequence_ = 0;
+    uint32_t last_arrival_timestamp_ = 0;
+    int64_t jitter_us_ = 0;
+    size_t target_depth_ = 1;
+    JitterBufferStats stats_;
+
+    void Flush();
+    void AllocateSlots(int frame_duration_ms);
+    uint8_t* SlotData(size_t index);
+    void UpdateJitter(uint32_t sequence, uint32_t timestamp, int64_t now);
+};
+
+#endif // JITTER_BUFFER_H
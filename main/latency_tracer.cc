@@ -0,0 +1,126 @@
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "LatencyTracer"
+
+static const uint32_t kBucketBoundsMs[LATENCY_BUCKET_COUNT] = LATENCY_BUCKET_BOUNDS_MS;
+
+static const char* const kStageNames[kLatencyStageCount] = {
+    "capture_to_afe",
+    "capture_to_encoded",
+    "capture_to_sent",
+    "receive_to_decoded",
+    "receive_to_output",
+};
+
+void LatencyHistogram::Record(uint32_t latency_us) {
+    uint32_t latency_ms = latency_us / 1000;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKET_COUNT - 1 && latency_ms >= kBucketBoundsMs[bucket]) {
+        bucket++;
+    }
+    buckets_[bucket]++;
+    count_++;
+    sum_ms_ += latency_ms;
+
+    uint32_t max_us = max_us_;
+    while (latency_us > max_us && !max_us_.compare_exchange_weak(max_us, latency_us)) {
+    }
+}
+
+void LatencyHistogram::Reset() {
+    for (auto& bucket : buckets_) {
+        bucket = 0;
+    }
+    count_ = 0;
+    sum_ms_ = 0;
+    max_us_ = 0;
+}
+
+uint32_t LatencyHistogram::average_ms() const {
+    uint32_t count = count_;
+    return count == 0 ? 0 : sum_ms_ / count;
+}
+
+uint32_t LatencyHistogram::PercentileMs(int percentile) const {
+    uint32_t count = count_;
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t target = (count * percentile + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKET_COUNT - 1; i++) {
+        seen += buckets_[i];
+        if (seen >= target) {
+            return kBucketBoundsMs[i];
+        }
+    }
+    // Open-ended bucket, the maximum is the best bound we have
+    return max_ms();
+}
+
+std::string LatencyHistogram::ToJson() const {
+    std::string json = "{\"count\":" + std::to_string(count()) +
+        ",\"avg_ms\":" + std::to_string(average_ms()) +
+        ",\"max_ms\":" + std::to_string(max_ms()) + ",\"buckets_ms\":[";
+    for (int i = 0; i < LATENCY_BUCKET_COUNT - 1; i++) {
+        if (i > 0) {
+            json += ",";
+        }
+        json += std::to_string(kBucketBoundsMs[i]);
+    }
+    json += "],\"counts\":[";
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        if (i > 0) {
+            json += ",";
+        }
+        json += std::to_string(buckets_[i].load());
+    }
+    json += "]}";
+    return json;
+}
+
+void LatencyTracer::Record(LatencyStage stage, int64_t start_time_us) {
+    if (start_time_us == 0) {
+        return;
+    }
+    int64_t latency_us = esp_timer_get_time() - start_time_us;
+    if (latency_us < 0) {
+        latency_us = 0;
+    } else if (latency_us > UINT32_MAX) {
+        latency_us = UINT32_MAX;
+    }
+    histograms_[stage].Record((uint32_t)latency_us);
+}
+
+void LatencyTracer::Reset() {
+    for (auto& histogram : histograms_) {
+        histogram.Reset();
+    }
+}
+
+std::string LatencyTracer::GetStatsJson() const {
+    std::string json = "{";
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        if (i > 0) {
+            json += ",";
+        }
+        json += "\"" + std::string(kStageNames[i]) + "\":" + histograms_[i].ToJson();
+    }
+    json += "}";
+    return json;
+}
+
+void LatencyTracer::PrintStats() const {
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto& histogram = histograms_[i];
+        if (histogram.count() == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: n=%lu avg=%lums p50<=%lums p95<=%lums max=%lums", kStageNames[i],
+            histogram.count(), histogram.average_ms(), histogram.PercentileMs(50),
+            histogram.PercentileMs(95), histogram.max_ms());
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Every stage is measured from the moment the frame entered the device,
+// so the difference between two stages is the cost of the step in between
+enum LatencyStage {
+    kLatencyCaptureToAfe,       // Uplink: ReadAudio -> AudioProcessor output
+    kLatencyCaptureToEncoded,   // Uplink: ReadAudio -> Opus packet ready
+    kLatencyCaptureToSent,      // Uplink: ReadAudio -> Protocol::SendAudio returned
+    kLatencyReceiveToDecoded,   // Downlink: packet received -> PCM decoded
+    kLatencyReceiveToOutput,    // Downlink: packet received -> AudioCodec::OutputData returned
+    kLatencyStageCount
+};
+
+// Upper bounds of the histogram buckets in milliseconds, the last bucket is open
+#define LATENCY_BUCKET_COUNT 10
+#define LATENCY_BUCKET_BOUNDS_MS { 5, 10, 20, 40, 80, 160, 320, 640, 1280, UINT32_MAX }
+
+// Fixed-bucket histogram, safe to record into from any task without locking
+class LatencyHistogram {
+public:
+    void Record(uint32_t latency_us);
+    void Reset();
+
+    uint32_t count() const { return count_; }
+    uint32_t average_ms() const;
+    uint32_t max_ms() const { return max_us_ / 1000; }
+    // Upper bound of the bucket holding the given percentile (0-100)
+    uint32_t PercentileMs(int percentile) const;
+    std::string ToJson() const;
+
+private:
+    std::atomic<uint32_t> buckets_[LATENCY_BUCKET_COUNT] = {};
+    std::atomic<uint32_t> count_{0};
+    std::atomic<uint32_t> sum_ms_{0};
+    std::atomic<uint32_t> max_us_{0};
+};
+
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+    // Delete copy constructor and assignment operator
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    // Records now - start_time_us (esp_timer time), a zero start time means untraced
+    void Record(LatencyStage stage, int64_t start_time_us);
+    void Reset();
+    // {"capture_to_afe":{"count":..,"avg_ms":..,"max_ms":..,"buckets_ms":[..],"counts":[..]},...}
+    std::string GetStatsJson() const;
+    // Logs one line per stage that has samples
+    void PrintStats() const;
+
+private:
+    LatencyTracer() = default;
+
+    LatencyHistogram histograms_[kLatencyStageCount];
+};
+
+#endif // LATENCY_TRACER_H
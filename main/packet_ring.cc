@@ -0,0 +1,199 @@
+#include "packet_ring.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <new>
+
+#define TAG "PacketRing"
+
+static void* AllocateSlab(size_t size) {
+    // Prefer PSRAM for the payload slab, internal RAM is reserved for DMA and stacks
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ptr == nullptr) {
+        ptr = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return ptr;
+}
+
+PacketRing::PacketRing(size_t max_packet_size) : max_packet_size_(max_packet_size) {
+}
+
+bool PacketRing::Allocate(size_t capacity, bool views_only) {
+    if (slots_ != nullptr) {
+        return true;
+    }
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    auto slots = (Slot*)AllocateSlab(sizeof(Slot) * rounded);
+    uint8_t* slab = nullptr;
+    if (!views_only) {
+        slab = (uint8_t*)AllocateSlab(max_packet_size_ * rounded);
+    }
+    if (slots == nullptr || (!views_only && slab == nullptr)) {
+        ESP_LOGE(TAG, "Failed to allocate %zu slots of %zu bytes", rounded, max_packet_size_);
+        heap_caps_free(slots);
+        heap_caps_free(slab);
+        return false;
+    }
+    for (size_t i = 0; i < rounded; i++) {
+        new (&slots[i].sequence) std::atomic<size_t>(i);
+        slots[i].size = 0;
+        slots[i].timestamp = 0;
+        slots[i].view = nullptr;
+    }
+    capacity_ = rounded;
+    mask_ = rounded - 1;
+    slab_ = slab;
+    slots_ = slots;
+    return true;
+}
+
+PacketRing::~PacketRing() {
+    if (slots_ != nullptr) {
+        for (size_t i = 0; i < capacity_; i++) {
+            slots_[i].sequence.~atomic();
+        }
+        heap_caps_free(slots_);
+    }
+    if (slab_ != nullptr) {
+        heap_caps_free(slab_);
+    }
+}
+
+bool PacketRing::AcquireWrite(size_t& index) {
+    if (slots_ == nullptr) {
+        return false;
+    }
+    index = write_index_.load(std::memory_order_relaxed);
+    while (true) {
+        Slot* slot = &slots_[index & mask_];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)index;
+        if (diff == 0) {
+            if (write_index_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        } else if (diff < 0) {
+            // Full
+            return false;
+        } else {
+            index = write_index_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void PacketRing::CommitWrite(size_t index, size_t size, int64_t timestamp, const uint8_t* view) {
+    Slot* slot = &slots_[index & mask_];
+    slot->size = size;
+    slot->timestamp = timestamp;
+    slot->view = view;
+    slot->sequence.store(index + 1, std::memory_order_release);
+}
+
+bool PacketRing::Push(const uint8_t* data, size_t size, int64_t timestamp) {
+    if (size > max_packet_size_) {
+        ESP_LOGW(TAG, "Packet too large: %zu > %zu", size, max_packet_size_);
+        return false;
+    }
+    size_t index;
+    if (slab_ == nullptr || !AcquireWrite(index)) {
+        return false;
+    }
+    memcpy(SlotData(index), data, size);
+    CommitWrite(index, size, timestamp, nullptr);
+    return true;
+}
+
+bool PacketRing::PushView(const uint8_t* data, size_t size, int64_t timestamp) {
+    // Views obey the same size limit so that Pop into a raw buffer stays safe
+    if (size > max_packet_size_) {
+        ESP_LOGW(TAG, "Packet too large: %zu > %zu", size, max_packet_size_);
+        return false;
+    }
+    size_t index;
+    if (!AcquireWrite(index)) {
+        return false;
+    }
+    CommitWrite(index, size, timestamp, data);
+    return true;
+}
+
+bool PacketRing::AcquireRead(size_t& index) {
+    if (slots_ == nullptr) {
+        return false;
+    }
+    index = read_index_.load(std::memory_order_relaxed);
+    while (true) {
+        Slot* slot = &slots_[index & mask_];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(index + 1);
+        if (diff == 0) {
+            if (read_index_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        } else if (diff < 0) {
+            // Empty
+            return false;
+        } else {
+            index = read_index_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void PacketRing::ReleaseRead(size_t index) {
+    slots_[index & mask_].sequence.store(index + capacity_, std::memory_order_release);
+}
+
+bool PacketRing::Pop(std::vector<uint8_t>& packet, int64_t* timestamp) {
+    size_t index;
+    if (!AcquireRead(index)) {
+        return false;
+    }
+    auto data = SlotPayload(index);
+    packet.assign(data, data + slots_[index & mask_].size);
+    if (timestamp != nullptr) {
+        *timestamp = slots_[index & mask_].timestamp;
+    }
+    ReleaseRead(index);
+    return true;
+}
+
+bool PacketRing::Pop(void* buffer, size_t& size, int64_t* timestamp) {
+    size_t index;
+    if (!AcquireRead(index)) {
+        return false;
+    }
+    size = slots_[index & mask_].size;
+    if (timestamp != nullptr) {
+        *timestamp = slots_[index & mask_].timestamp;
+    }
+    memcpy(buffer, SlotPayload(index), size);
+    ReleaseRead(index);
+    return true;
+}
+
+bool PacketRing::DropOldest() {
+    size_t index;
+    if (!AcquireRead(index)) {
+        return false;
+    }
+    ReleaseRead(index);
+    return true;
+}
+
+void PacketRing::Clear() {
+    size_t index;
+    while (AcquireRead(index)) {
+        ReleaseRead(index);
+    }
+}
+
+size_t PacketRing::Size() const {
+    size_t write_index = write_index_.load(std::memory_order_acquire);
+    size_t read_index = read_index_.load(std::memory_order_acquire);
+    return write_index > read_index ? write_index - read_index : 0;
+}
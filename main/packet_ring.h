@@ -0,0 +1,81 @@
+#ifndef PACKET_RING_H
+#define PACKET_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Opus allows at most 1275 bytes per frame, round up to keep slots aligned
+#define OPUS_MAX_PACKET_SIZE 1280
+// Slot size for queued speech packets, 60ms at 32kbps is 240 bytes.
+// Anything larger is rejected and counted as dropped by the caller.
+#define OPUS_PACKET_SLOT_SIZE 256
+
+// Fixed-capacity lock-free packet queue backed by a single slab allocation.
+// Producers and consumers never allocate and never block each other: every slot
+// carries a sequence number (bounded MPMC queue by Dmitry Vyukov), so the
+// network task, PlaySound and the audio loop can all touch it without a mutex.
+//
+// Nothing is allocated until Allocate(), so an unused ring costs no RAM. Until then
+// the ring behaves as full for producers and empty for consumers.
+class PacketRing {
+public:
+    explicit PacketRing(size_t max_packet_size = OPUS_PACKET_SLOT_SIZE);
+    ~PacketRing();
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator=(const PacketRing&) = delete;
+
+    // Call once before the ring is shared between tasks, `capacity` is rounded up to a power of two.
+    // A ring that only takes PushView() skips the payload slab. Returns false if out of memory.
+    bool Allocate(size_t capacity, bool views_only = false);
+    inline bool allocated() const { return slots_ != nullptr; }
+
+    // Returns false if the ring is full or the packet is larger than a slot.
+    // `timestamp` travels with the packet, e.g. the capture time for latency tracing.
+    bool Push(const uint8_t* data, size_t size, int64_t timestamp = 0);
+    // Queues a non-owning view instead of a copy, e.g. a packet inside an embedded asset.
+    // `data` must stay valid until the packet has been popped or dropped.
+    bool PushView(const uint8_t* data, size_t size, int64_t timestamp = 0);
+    // Copies the oldest packet into `packet`, reusing its capacity
+    bool Pop(std::vector<uint8_t>& packet, int64_t* timestamp = nullptr);
+    // Copies the oldest packet into a raw buffer of at least max_packet_size() bytes
+    bool Pop(void* buffer, size_t& size, int64_t* timestamp = nullptr);
+    // Drops the oldest packet, used by producers that prefer fresh data
+    bool DropOldest();
+    // Drops all queued packets, safe to call from any task
+    void Clear();
+
+    size_t Size() const;
+    bool Empty() const { return Size() == 0; }
+    inline size_t capacity() const { return capacity_; }
+    inline size_t max_packet_size() const { return max_packet_size_; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        uint16_t size;
+        int64_t timestamp;
+        const uint8_t* view;  // Points outside the slab for packets queued with PushView
+    };
+
+    size_t capacity_ = 0;
+    size_t mask_ = 0;
+    size_t max_packet_size_;
+    Slot* slots_ = nullptr;
+    uint8_t* slab_ = nullptr;
+    std::atomic<size_t> write_index_{0};
+    std::atomic<size_t> read_index_{0};
+
+    bool AcquireWrite(size_t& index);
+    void CommitWrite(size_t index, size_t size, int64_t timestamp, const uint8_t* view);
+    bool AcquireRead(size_t& index);
+    void ReleaseRead(size_t index);
+    inline uint8_t* SlotData(size_t index) { return slab_ + (index & mask_) * max_packet_size_; }
+    inline const uint8_t* SlotPayload(size_t index) {
+        auto view = slots_[index & mask_].view;
+        return view != nullptr ? view : SlotData(index);
+    }
+};
+
+#endif // PACKET_RING_H
@@ -0,0 +1,56 @@
+#include "cbor.h"
+
+#include <cmath>
+#include <cstring>
+
+const uint8_t* ReadCborHead(const uint8_t* p, const uint8_t* end, CborHead& head) {
+    if (p >= end) {
+        return nullptr;
+    }
+    head.major = *p >> 5;
+    head.info = *p & 0x1f;
+    head.value = 0;
+    head.indefinite = false;
+    p++;
+    if (head.info < 24) {
+        head.value = head.info;
+        return p;
+    } else if (head.info == kCborIndefinite) {
+        head.indefinite = true;
+        return head.major >= kCborBytes && head.major <= kCborMap ? p : nullptr;
+    } else if (head.info > 27) {
+        return nullptr;
+    }
+    size_t length = size_t(1) << (head.info - 24);
+    if (size_t(end - p) < length) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < length; i++) {
+        head.value = (head.value << 8) | *p++;
+    }
+    return p;
+}
+
+double CborFloat(const CborHead& head) {
+    if (head.info == 25) {
+        int exponent = (head.value >> 10) & 0x1f;
+        int mantissa = head.value & 0x3ff;
+        double value;
+        if (exponent == 0) {
+            value = std::ldexp(mantissa, -24);
+        } else if (exponent != 31) {
+            value = std::ldexp(mantissa + 1024, exponent - 25);
+        } else {
+            value = mantissa == 0 ? INFINITY : NAN;
+        }
+        return head.value & 0x8000 ? -value : value;
+    } else if (head.info == 26) {
+        uint32_t bits = uint32_t(head.value);
+        float single;
+        memcpy(&single, &bits, sizeof(single));
+        return single;
+    }
+    double full;
+    memcpy(&full, &head.value, sizeof(full));
+    return full;
+}
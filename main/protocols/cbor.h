@@ -0,0 +1,35 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+// The CBOR (RFC 8949) subset of binary control messages, read by JsonView in place and by
+// ControlItemToJson() when a part has to be handed on as JSON text
+enum CborMajor : uint8_t {
+    kCborUnsigned = 0,
+    kCborNegative = 1,
+    kCborBytes = 2,
+    kCborText = 3,
+    kCborArray = 4,
+    kCborMap = 5,
+    kCborTag = 6,
+    kCborSimple = 7
+};
+
+constexpr uint8_t kCborIndefinite = 31;
+constexpr uint8_t kCborBreak = 0xff;
+
+struct CborHead {
+    uint8_t major;
+    uint8_t info;
+    uint64_t value;  // The argument, a length for strings and containers
+    bool indefinite;
+};
+
+// Reads an initial byte and its argument, returns the position after them or nullptr if malformed
+const uint8_t* ReadCborHead(const uint8_t* p, const uint8_t* end, CborHead& head);
+// Value of a simple head with a half, single or double float argument
+double CborFloat(const CborHead& head);
+
+#endif // CBOR_H
@@ -0,0 +1,556 @@
+#include "control_message.h"
+#include "cbor.h"
+#include "json_view.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#define TAG "ControlMessage"
+
+namespace {
+
+constexpr uint8_t kCborFalse = 0xf4;
+constexpr uint8_t kCborTrue = 0xf5;
+constexpr uint8_t kCborNull = 0xf6;
+constexpr uint8_t kCborFloat64 = 0xfb;
+constexpr uint8_t kCborIndefiniteArray = 0x9f;
+constexpr uint8_t kCborIndefiniteMap = 0xbf;
+
+// Indexed by ControlKey and ControlType
+const char* const kKeyNames[kControlKeyCount] = {
+    "type", "session_id", "state", "mode", "text", "reason", "emotion", "status", "message", "command",
+    "update", "states", "descriptors", "commands", "stats", "name", "method", "parameters", "properties",
+    "methods", "description", "value"
+};
+
+const char* const kTypeNames[kControlTypeCount] = {
+    "hello", "listen", "abort", "tts", "stt", "llm", "iot", "system", "alert", "stats", "goodbye"
+};
+
+int FindName(const char* const* names, int count, const char* name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void AppendEscaped(std::string& out, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+                break;
+        }
+    }
+}
+
+// Bounds checked reader, any error sticks and fails the whole message
+class CborReader {
+public:
+    CborReader(const uint8_t* data, size_t size) : p_(data), end_(data + size) {
+    }
+
+    bool ok() const { return ok_; }
+    bool AtEnd() const { return p_ == end_; }
+
+    bool PeekBreak() {
+        return ok_ && p_ < end_ && *p_ == kCborBreak;
+    }
+
+    void SkipBreak() {
+        p_++;
+    }
+
+    bool ReadHead(CborHead& head) {
+        if (!ok_) {
+            return false;
+        }
+        auto p = ReadCborHead(p_, end_, head);
+        if (p == nullptr) {
+            return Fail();
+        }
+        p_ = p;
+        return true;
+    }
+
+    const uint8_t* ReadBytes(uint64_t length) {
+        if (!ok_ || uint64_t(end_ - p_) < length) {
+            Fail();
+            return nullptr;
+        }
+        const uint8_t* bytes = p_;
+        p_ += length;
+        return bytes;
+    }
+
+    bool Fail() {
+        ok_ = false;
+        return false;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    bool ok_ = true;
+};
+
+bool ReadItem(CborReader& reader, int depth, bool top_level_type, std::string& json);
+
+// Text strings, definite or made of definite chunks, appended as a JSON string
+bool ReadText(CborReader& reader, uint64_t length, bool indefinite, std::string& json) {
+    json += '"';
+    if (!indefinite) {
+        auto bytes = reader.ReadBytes(length);
+        if (bytes == nullptr) {
+            return false;
+        }
+        AppendEscaped(json, (const char*)bytes, length);
+    } else {
+        while (!reader.PeekBreak()) {
+            CborHead chunk;
+            if (!reader.ReadHead(chunk) || chunk.major != kCborText || chunk.indefinite) {
+                return reader.Fail();
+            }
+            auto bytes = reader.ReadBytes(chunk.value);
+            if (bytes == nullptr) {
+                return false;
+            }
+            AppendEscaped(json, (const char*)bytes, chunk.value);
+        }
+        if (!reader.ok()) {
+            return false;
+        }
+        reader.SkipBreak();
+    }
+    json += '"';
+    return true;
+}
+
+bool ReadMap(CborReader& reader, uint64_t count, bool indefinite, int depth, std::string& json) {
+    json += '{';
+    for (uint64_t i = 0; indefinite || i < count; i++) {
+        if (indefinite && reader.PeekBreak()) {
+            reader.SkipBreak();
+            break;
+        }
+        if (i > 0) {
+            json += ',';
+        }
+        CborHead key;
+        if (!reader.ReadHead(key)) {
+            return false;
+        }
+        bool type_key;
+        if (key.major == kCborUnsigned && key.value < kControlKeyCount) {
+            json += '"';
+            json += kKeyNames[key.value];
+            json += '"';
+            type_key = key.value == kControlKeyType;
+        } else if (key.major == kCborText) {
+            size_t key_start = json.size();
+            if (!ReadText(reader, key.value, key.indefinite, json)) {
+                return false;
+            }
+            type_key = json.compare(key_start, std::string::npos, "\"type\"") == 0;
+        } else {
+            return reader.Fail();
+        }
+        json += ':';
+        // Only the envelope type is an enum, "type" also appears inside IoT descriptors
+        if (!ReadItem(reader, depth + 1, depth == 0 && type_key, json)) {
+            return false;
+        }
+    }
+    json += '}';
+    return reader.ok();
+}
+
+bool ReadArray(CborReader& reader, uint64_t count, bool indefinite, int depth, std::string& json) {
+    json += '[';
+    for (uint64_t i = 0; indefinite || i < count; i++) {
+        if (indefinite && reader.PeekBreak()) {
+            reader.SkipBreak();
+            break;
+        }
+        if (i > 0) {
+            json += ',';
+        }
+        if (!ReadItem(reader, depth + 1, false, json)) {
+            return false;
+        }
+    }
+    json += ']';
+    return reader.ok();
+}
+
+void AppendNumber(std::string& json, double number, int digits) {
+    if (!std::isfinite(number)) {
+        json += "null";
+        return;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.*g", digits, number);
+    json += text;
+}
+
+bool ReadItem(CborReader& reader, int depth, bool top_level_type, std::string& json) {
+    if (depth > CONTROL_MESSAGE_MAX_DEPTH) {
+        return reader.Fail();
+    }
+    CborHead head;
+    if (!reader.ReadHead(head)) {
+        return false;
+    }
+
+    uint64_t value = head.value;
+    char number[24];
+    switch (head.major) {
+        case kCborUnsigned:
+            if (top_level_type && value < kControlTypeCount) {
+                json += '"';
+                json += kTypeNames[value];
+                json += '"';
+            } else {
+                snprintf(number, sizeof(number), "%llu", (unsigned long long)value);
+                json += number;
+            }
+            return true;
+        case kCborNegative:
+            if (value < INT64_MAX) {
+                snprintf(number, sizeof(number), "%lld", -1 - (long long)value);
+                json += number;
+            } else {
+                AppendNumber(json, -1.0 - double(value), 17);
+            }
+            return true;
+        case kCborText:
+            return ReadText(reader, value, head.indefinite, json);
+        case kCborArray:
+            return ReadArray(reader, value, head.indefinite, depth, json);
+        case kCborMap:
+            return ReadMap(reader, value, head.indefinite, depth, json);
+        case kCborSimple:
+            if (head.info == 20) {
+                json += "false";
+                return true;
+            } else if (head.info == 21) {
+                json += "true";
+                return true;
+            } else if (head.info == 22 || head.info == 23) {
+                json += "null";
+                return true;
+            } else if (head.info >= 25 && head.info <= 27) {
+                // Printed with the digits their precision holds, so they read back the same
+                AppendNumber(json, CborFloat(head), head.info == 25 ? 5 : (head.info == 26 ? 9 : 17));
+                return true;
+            }
+            break;
+        default:
+            // Byte strings and tags have no JSON equivalent in the schema
+            break;
+    }
+    return reader.Fail();
+}
+
+} // namespace
+
+ControlMessageWriter::ControlMessageWriter(bool binary) : binary_(binary) {
+    if (binary_) {
+        data_.reserve(64);
+        data_.push_back(kCborIndefiniteMap);
+    } else {
+        text_.reserve(96);
+        text_ = "{";
+    }
+}
+
+void ControlMessageWriter::WriteHead(uint8_t major, uint64_t value) {
+    major <<= 5;
+    if (value < 24) {
+        data_.push_back(major | value);
+        return;
+    }
+    int length;
+    if (value <= 0xff) {
+        data_.push_back(major | 24);
+        length = 1;
+    } else if (value <= 0xffff) {
+        data_.push_back(major | 25);
+        length = 2;
+    } else if (value <= 0xffffffff) {
+        data_.push_back(major | 26);
+        length = 4;
+    } else {
+        data_.push_back(major | 27);
+        length = 8;
+    }
+    for (int i = length - 1; i >= 0; i--) {
+        data_.push_back(uint8_t(value >> (i * 8)));
+    }
+}
+
+void ControlMessageWriter::WriteText(const char* text, size_t length) {
+    WriteHead(kCborText, length);
+    data_.insert(data_.end(), (const uint8_t*)text, (const uint8_t*)text + length);
+}
+
+void ControlMessageWriter::AddKey(const char* key) {
+    if (binary_) {
+        int index = FindName(kKeyNames, kControlKeyCount, key);
+        if (index >= 0) {
+            WriteHead(kCborUnsigned, index);
+        } else {
+            WriteText(key, strlen(key));
+        }
+    } else {
+        if (!empty_) {
+            text_ += ",";
+        }
+        text_ += "\"";
+        text_ += key;
+        text_ += "\":";
+    }
+    empty_ = false;
+}
+
+ControlMessageWriter& ControlMessageWriter::Add(const char* key, const char* value) {
+    AddKey(key);
+    if (binary_) {
+        int type = strcmp(key, "type") == 0 ? FindName(kTypeNames, kControlTypeCount, value) : -1;
+        if (type >= 0) {
+            WriteHead(kCborUnsigned, type);
+        } else {
+            WriteText(value, strlen(value));
+        }
+    } else {
+        text_ += "\"";
+        AppendEscaped(text_, value, strlen(value));
+        text_ += "\"";
+    }
+    return *this;
+}
+
+ControlMessageWriter& ControlMessageWriter::Add(const char* key, const std::string& value) {
+    return Add(key, value.c_str());
+}
+
+ControlMessageWriter& ControlMessageWriter::Add(const char* key, bool value) {
+    AddKey(key);
+    if (binary_) {
+        data_.push_back(value ? kCborTrue : kCborFalse);
+    } else {
+        text_ += value ? "true" : "false";
+    }
+    return *this;
+}
+
+ControlMessageWriter& ControlMessageWriter::AddJson(const char* key, const std::string& json) {
+    if (!binary_) {
+        AddKey(key);
+        text_ += json;
+        return *this;
+    }
+    // Converted straight from the text, no tree is built
+    JsonView view;
+    if (!JsonView::Parse(json.data(), json.size(), view)) {
+        ESP_LOGE(TAG, "Failed to parse the value of %s", key);
+        return *this;
+    }
+    AddKey(key);
+    WriteView(view, 1);
+    return *this;
+}
+
+ControlMessageWriter& ControlMessageWriter::AddJson(const char* key, const cJSON* item) {
+    if (!binary_) {
+        char* json = cJSON_PrintUnformatted(item);
+        if (json == nullptr) {
+            ESP_LOGE(TAG, "Failed to print the value of %s", key);
+            return *this;
+        }
+        AddKey(key);
+        text_ += json;
+        cJSON_free(json);
+        return *this;
+    }
+    AddKey(key);
+    WriteItem(item, 1);
+    return *this;
+}
+
+ControlMessageWriter& ControlMessageWriter::Append(const ControlMessageWriter& body) {
+    if (body.binary_ != binary_ || body.closed_ || closed_) {
+        ESP_LOGE(TAG, "Cannot append a closed message or one of another encoding");
+        return *this;
+    } else if (body.empty_) {
+        return *this;
+    }
+    if (binary_) {
+        // Without the head of the body's map
+        data_.insert(data_.end(), body.data_.begin() + 1, body.data_.end());
+    } else {
+        if (!empty_) {
+            text_ += ",";
+        }
+        text_.append(body.text_, 1, std::string::npos);
+    }
+    empty_ = false;
+    return *this;
+}
+
+void ControlMessageWriter::WriteNumber(double number) {
+    if (number == std::floor(number) && std::fabs(number) < 9.0e15) {
+        if (number >= 0) {
+            WriteHead(kCborUnsigned, uint64_t(number));
+        } else {
+            WriteHead(kCborNegative, uint64_t(-1 - number));
+        }
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        data_.push_back(kCborFloat64);
+        for (int i = 7; i >= 0; i--) {
+            data_.push_back(uint8_t(bits >> (i * 8)));
+        }
+    }
+}
+
+void ControlMessageWriter::WriteItem(const cJSON* item, int depth) {
+    if (depth > CONTROL_MESSAGE_MAX_DEPTH) {
+        data_.push_back(kCborNull);
+        return;
+    }
+    if (cJSON_IsObject(item)) {
+        WriteHead(kCborMap, cJSON_GetArraySize(item));
+        for (const cJSON* child = item->child; child != nullptr; child = child->next) {
+            int index = FindName(kKeyNames, kControlKeyCount, child->string);
+            if (index >= 0) {
+                WriteHead(kCborUnsigned, index);
+            } else {
+                WriteText(child->string, strlen(child->string));
+            }
+            WriteItem(child, depth + 1);
+        }
+    } else if (cJSON_IsArray(item)) {
+        WriteHead(kCborArray, cJSON_GetArraySize(item));
+        for (const cJSON* child = item->child; child != nullptr; child = child->next) {
+            WriteItem(child, depth + 1);
+        }
+    } else if (cJSON_IsString(item)) {
+        WriteText(item->valuestring, strlen(item->valuestring));
+    } else if (cJSON_IsNumber(item)) {
+        WriteNumber(item->valuedouble);
+    } else if (cJSON_IsBool(item)) {
+        data_.push_back(cJSON_IsTrue(item) ? kCborTrue : kCborFalse);
+    } else {
+        data_.push_back(kCborNull);
+    }
+}
+
+// Same output as WriteItem() on the parsed tree, except that containers are written
+// indefinite length, their size would take a second scan
+void ControlMessageWriter::WriteView(const JsonView& view, int depth) {
+    if (depth > CONTROL_MESSAGE_MAX_DEPTH) {
+        data_.push_back(kCborNull);
+        return;
+    }
+    switch (view.type()) {
+        case kJsonObject:
+        case kJsonArray:
+            data_.push_back(view.IsObject() ? kCborIndefiniteMap : kCborIndefiniteArray);
+            view.ForEach([this, depth](const JsonView& key, const JsonView& value) {
+                if (key) {
+                    std::string name = key.ToString();
+                    int index = FindName(kKeyNames, kControlKeyCount, name.c_str());
+                    if (index >= 0) {
+                        WriteHead(kCborUnsigned, index);
+                    } else {
+                        WriteText(name.data(), name.size());
+                    }
+                }
+                WriteView(value, depth + 1);
+                return true;
+            });
+            data_.push_back(kCborBreak);
+            break;
+        case kJsonString: {
+            std::string text = view.ToString();
+            WriteText(text.data(), text.size());
+            break;
+        }
+        case kJsonNumber:
+            WriteNumber(view.ToNumber());
+            break;
+        case kJsonTrue:
+            data_.push_back(kCborTrue);
+            break;
+        case kJsonFalse:
+            data_.push_back(kCborFalse);
+            break;
+        default:
+            data_.push_back(kCborNull);
+            break;
+    }
+}
+
+const std::string& ControlMessageWriter::text() {
+    if (!closed_) {
+        text_ += "}";
+        closed_ = true;
+    }
+    return text_;
+}
+
+const std::vector<uint8_t>& ControlMessageWriter::data() {
+    if (!closed_) {
+        data_.push_back(kCborBreak);
+        closed_ = true;
+    }
+    return data_;
+}
+
+const char* ControlKeyName(uint64_t key) {
+    return key < kControlKeyCount ? kKeyNames[key] : nullptr;
+}
+
+const char* ControlTypeName(uint64_t type) {
+    return type < kControlTypeCount ? kTypeNames[type] : nullptr;
+}
+
+bool ControlItemToJson(const uint8_t* data, size_t size, bool envelope, std::string& json) {
+    json.clear();
+    CborReader reader(data, size);
+    bool ok;
+    if (envelope) {
+        CborHead head;
+        if (!reader.ReadHead(head) || head.major != kCborMap) {
+            ESP_LOGE(TAG, "Control message is not a map");
+            return false;
+        }
+        ok = ReadMap(reader, head.value, head.indefinite, 0, json);
+    } else {
+        ok = ReadItem(reader, 1, false, json);
+    }
+    if (!ok || !reader.AtEnd()) {
+        ESP_LOGE(TAG, "Malformed control message of %zu bytes", size);
+        json.clear();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef CONTROL_MESSAGE_H
+#define CONTROL_MESSAGE_H
+
+#include <cJSON.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class JsonView;
+
+// Nesting allowed in a control message when reading or writing it, in either encoding.
+// Deep enough for IoT descriptors, shallow enough for the stack of the network tasks.
+#define CONTROL_MESSAGE_MAX_DEPTH 16
+
+// Control messages are JSON text, or CBOR (RFC 8949) when the binary control protocol
+// was negotiated in hello. The CBOR form is the same object with a fixed schema:
+// known keys are replaced by small integers and so is the value of the top level "type".
+// Unknown keys and values are carried as text, so the schema can grow on either side.
+enum ControlKey {
+    kControlKeyType = 0,
+    kControlKeySessionId,
+    kControlKeyState,
+    kControlKeyMode,
+    kControlKeyText,
+    kControlKeyReason,
+    kControlKeyEmotion,
+    kControlKeyStatus,
+    kControlKeyMessage,
+    kControlKeyCommand,
+    kControlKeyUpdate,
+    kControlKeyStates,
+    kControlKeyDescriptors,
+    kControlKeyCommands,
+    kControlKeyStats,
+    kControlKeyName,
+    kControlKeyMethod,
+    kControlKeyParameters,
+    kControlKeyProperties,
+    kControlKeyMethods,
+    kControlKeyDescription,
+    kControlKeyValue,
+    kControlKeyCount
+};
+
+enum ControlType {
+    kControlTypeHello = 0,
+    kControlTypeListen,
+    kControlTypeAbort,
+    kControlTypeTts,
+    kControlTypeStt,
+    kControlTypeLlm,
+    kControlTypeIot,
+    kControlTypeSystem,
+    kControlTypeAlert,
+    kControlTypeStats,
+    kControlTypeGoodbye,
+    kControlTypeCount
+};
+
+// Builds one control message in either encoding, keys are written in the order they are added
+class ControlMessageWriter {
+public:
+    explicit ControlMessageWriter(bool binary);
+
+    ControlMessageWriter& Add(const char* key, const std::string& value);
+    ControlMessageWriter& Add(const char* key, const char* value);
+    ControlMessageWriter& Add(const char* key, bool value);
+    // `json` is a JSON value, embedded as is in text mode and converted in binary mode
+    ControlMessageWriter& AddJson(const char* key, const std::string& json);
+    ControlMessageWriter& AddJson(const char* key, const cJSON* item);
+    // Appends the members of `body`, an unclosed message of the same encoding, so a
+    // body serialized once can be sent behind per-session keys without rebuilding it
+    ControlMessageWriter& Append(const ControlMessageWriter& body);
+
+    inline bool binary() const { return binary_; }
+    // Closes the message, only the getter of the chosen encoding is valid
+    const std::string& text();
+    const std::vector<uint8_t>& data();
+
+private:
+    bool binary_;
+    bool closed_ = false;
+    bool empty_ = true;
+    std::string text_;
+    std::vector<uint8_t> data_;
+
+    void AddKey(const char* key);
+    void WriteHead(uint8_t major, uint64_t value);
+    void WriteText(const char* text, size_t length);
+    void WriteNumber(double number);
+    void WriteItem(const cJSON* item, int depth);
+    void WriteView(const JsonView& view, int depth);
+};
+
+// Name of an integer key or envelope type, nullptr if out of range
+const char* ControlKeyName(uint64_t key);
+const char* ControlTypeName(uint64_t type);
+
+// Converts one CBOR item of a control message to JSON text, `json` keeps its capacity.
+// Incoming messages are read in place through JsonView::ParseCbor(), this is for the
+// parts that have to be handed on as JSON. `envelope` is set for a whole message,
+// whose "type" value is an enum. Returns false on malformed input.
+bool ControlItemToJson(const uint8_t* data, size_t size, bool envelope, std::string& json);
+
+#endif // CONTROL_MESSAGE_H
@@ -0,0 +1,729 @@
+#include "json_view.h"
+#include "control_message.h"
+#include "cbor.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+inline const char* SkipSpace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+inline int HexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool ReadHex4(const char* p, const char* end, int& value) {
+    if (end - p < 4) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = HexValue(p[i]);
+        if (digit < 0) {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    return true;
+}
+
+// `p` points at the opening quote, returns the position after the closing quote
+const char* ScanString(const char* p, const char* end) {
+    p++;
+    while (p < end) {
+        unsigned char c = *p;
+        if (c == '"') {
+            return p + 1;
+        } else if (c < 0x20) {
+            return nullptr;
+        } else if (c == '\\') {
+            if (++p >= end) {
+                return nullptr;
+            }
+            int value;
+            switch (*p) {
+                case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                    p++;
+                    break;
+                case 'u':
+                    if (!ReadHex4(p + 1, end, value)) {
+                        return nullptr;
+                    }
+                    p += 5;
+                    break;
+                default:
+                    return nullptr;
+            }
+        } else {
+            p++;
+        }
+    }
+    return nullptr;
+}
+
+const char* ScanNumber(const char* p, const char* end) {
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p >= end) {
+        return nullptr;
+    }
+    if (*p == '0') {
+        p++;
+    } else if (*p >= '1' && *p <= '9') {
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    } else {
+        return nullptr;
+    }
+    if (p < end && *p == '.') {
+        const char* digits = ++p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (p == digits) {
+            return nullptr;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        const char* digits = p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (p == digits) {
+            return nullptr;
+        }
+    }
+    return p;
+}
+
+inline const char* ScanLiteral(const char* p, const char* end, const char* literal, size_t length) {
+    if (size_t(end - p) < length || memcmp(p, literal, length) != 0) {
+        return nullptr;
+    }
+    return p + length;
+}
+
+// `p` points at the first character of a value, returns the position after it
+const char* ScanValue(const char* p, const char* end, int depth, JsonType& type) {
+    if (p >= end || depth > CONTROL_MESSAGE_MAX_DEPTH) {
+        return nullptr;
+    }
+    switch (*p) {
+        case '"':
+            type = kJsonString;
+            return ScanString(p, end);
+        case 't':
+            type = kJsonTrue;
+            return ScanLiteral(p, end, "true", 4);
+        case 'f':
+            type = kJsonFalse;
+            return ScanLiteral(p, end, "false", 5);
+        case 'n':
+            type = kJsonNull;
+            return ScanLiteral(p, end, "null", 4);
+        case '{':
+        case '[': {
+            bool object = *p == '{';
+            char close = object ? '}' : ']';
+            type = object ? kJsonObject : kJsonArray;
+            p = SkipSpace(p + 1, end);
+            if (p < end && *p == close) {
+                return p + 1;
+            }
+            while (p < end) {
+                JsonType member_type;
+                if (object) {
+                    if (*p != '"' || (p = ScanString(p, end)) == nullptr) {
+                        return nullptr;
+                    }
+                    p = SkipSpace(p, end);
+                    if (p >= end || *p != ':') {
+                        return nullptr;
+                    }
+                    p = SkipSpace(p + 1, end);
+                }
+                if ((p = ScanValue(p, end, depth + 1, member_type)) == nullptr) {
+                    return nullptr;
+                }
+                p = SkipSpace(p, end);
+                if (p < end && *p == ',') {
+                    p = SkipSpace(p + 1, end);
+                } else if (p < end && *p == close) {
+                    return p + 1;
+                } else {
+                    return nullptr;
+                }
+            }
+            return nullptr;
+        }
+        default:
+            type = kJsonNumber;
+            return ScanNumber(p, end);
+    }
+}
+
+// Decodes the escaped content between `p` and `end`, already validated, byte by byte.
+// Stops early when `emit` returns false.
+template <typename Emit>
+void Unescape(const char* p, const char* end, Emit emit) {
+    while (p < end) {
+        if (*p != '\\') {
+            if (!emit(*p++)) {
+                return;
+            }
+            continue;
+        }
+        p++;
+        char c = *p++;
+        int code = 0;
+        switch (c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                ReadHex4(p, end, code);
+                p += 4;
+                if (code >= 0xd800 && code <= 0xdbff) {
+                    int low;
+                    if (end - p >= 6 && p[0] == '\\' && p[1] == 'u' && ReadHex4(p + 2, end, low) &&
+                        low >= 0xdc00 && low <= 0xdfff) {
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    } else {
+                        code = 0xfffd;
+                    }
+                } else if (code >= 0xdc00 && code <= 0xdfff) {
+                    code = 0xfffd;
+                }
+                break;
+            default:
+                // '"', '\\' and '/' stand for themselves
+                break;
+        }
+        if (c != 'u') {
+            if (!emit(c)) {
+                return;
+            }
+            continue;
+        }
+        char utf8[4];
+        int length;
+        if (code < 0x80) {
+            utf8[0] = code;
+            length = 1;
+        } else if (code < 0x800) {
+            utf8[0] = 0xc0 | (code >> 6);
+            utf8[1] = 0x80 | (code & 0x3f);
+            length = 2;
+        } else if (code < 0x10000) {
+            utf8[0] = 0xe0 | (code >> 12);
+            utf8[1] = 0x80 | ((code >> 6) & 0x3f);
+            utf8[2] = 0x80 | (code & 0x3f);
+            length = 3;
+        } else {
+            utf8[0] = 0xf0 | (code >> 18);
+            utf8[1] = 0x80 | ((code >> 12) & 0x3f);
+            utf8[2] = 0x80 | ((code >> 6) & 0x3f);
+            utf8[3] = 0x80 | (code & 0x3f);
+            length = 4;
+        }
+        for (int i = 0; i < length; i++) {
+            if (!emit(utf8[i])) {
+                return;
+            }
+        }
+    }
+}
+
+// Compares an escaped string body with plain text
+bool StringEquals(const char* p, const char* end, const char* text) {
+    if (memchr(p, '\\', end - p) == nullptr) {
+        size_t length = strlen(text);
+        return size_t(end - p) == length && memcmp(p, text, length) == 0;
+    }
+    bool equal = true;
+    Unescape(p, end, [&text, &equal](char c) {
+        // An escaped NUL cannot match, and must not step past the end of `text`
+        if (*text == '\0' || *text != c) {
+            equal = false;
+            return false;
+        }
+        text++;
+        return true;
+    });
+    return equal && *text == '\0';
+}
+
+// Binary control messages, the encoding is described in control_message.h
+
+// `p` points at the head of an item, returns the position after it. Accepts what
+// ControlItemToJson() accepts, non-finite floats read as null like they convert.
+const uint8_t* ScanCbor(const uint8_t* p, const uint8_t* end, int depth, JsonType& type) {
+    CborHead head;
+    if (depth > CONTROL_MESSAGE_MAX_DEPTH || (p = ReadCborHead(p, end, head)) == nullptr) {
+        return nullptr;
+    }
+    switch (head.major) {
+        case kCborUnsigned:
+        case kCborNegative:
+            type = kJsonNumber;
+            return p;
+        case kCborText:
+            type = kJsonString;
+            if (!head.indefinite) {
+                return head.value <= uint64_t(end - p) ? p + head.value : nullptr;
+            }
+            while (p < end && *p != kCborBreak) {
+                CborHead chunk;
+                if ((p = ReadCborHead(p, end, chunk)) == nullptr || chunk.major != kCborText || chunk.indefinite ||
+                    chunk.value > uint64_t(end - p)) {
+                    return nullptr;
+                }
+                p += chunk.value;
+            }
+            return p < end ? p + 1 : nullptr;
+        case kCborArray:
+        case kCborMap: {
+            bool map = head.major == kCborMap;
+            type = map ? kJsonObject : kJsonArray;
+            // Every item takes at least one byte, a bogus count runs into the end
+            for (uint64_t i = 0; head.indefinite || i < head.value; i++) {
+                if (head.indefinite && p < end && *p == kCborBreak) {
+                    return p + 1;
+                }
+                JsonType member_type;
+                if (map) {
+                    // Known keys are small integers, others are text
+                    CborHead key;
+                    if (ReadCborHead(p, end, key) == nullptr ||
+                        (key.major == kCborUnsigned && ControlKeyName(key.value) == nullptr) ||
+                        (key.major != kCborUnsigned && key.major != kCborText) ||
+                        (p = ScanCbor(p, end, depth + 1, member_type)) == nullptr) {
+                        return nullptr;
+                    }
+                }
+                if ((p = ScanCbor(p, end, depth + 1, member_type)) == nullptr) {
+                    return nullptr;
+                }
+            }
+            return p;
+        }
+        case kCborSimple:
+            if (head.info == 20) {
+                type = kJsonFalse;
+            } else if (head.info == 21) {
+                type = kJsonTrue;
+            } else if (head.info == 22 || head.info == 23) {
+                type = kJsonNull;
+            } else if (head.info >= 25 && head.info <= 27) {
+                type = std::isfinite(CborFloat(head)) ? kJsonNumber : kJsonNull;
+            } else {
+                return nullptr;
+            }
+            return p;
+        default:
+            // Byte strings and tags have no JSON equivalent in the schema
+            return nullptr;
+    }
+}
+
+} // namespace
+
+template <typename Chunk>
+void JsonView::ForEachCborChunk(Chunk chunk) const {
+    if (encoding_ == kEncodingName) {
+        chunk(data_, size_);
+        return;
+    }
+    auto p = (const uint8_t*)data_;
+    auto end = p + size_;
+    CborHead head;
+    p = ReadCborHead(p, end, head);
+    if (!head.indefinite) {
+        chunk((const char*)p, head.value);
+        return;
+    }
+    while (*p != kCborBreak) {
+        CborHead piece;
+        p = ReadCborHead(p, end, piece);
+        if (!chunk((const char*)p, piece.value)) {
+            return;
+        }
+        p += piece.value;
+    }
+}
+
+bool JsonView::Parse(const char* data, size_t size, JsonView& root) {
+    const char* end = data + size;
+    const char* begin = SkipSpace(data, end);
+    JsonType type;
+    const char* value_end = ScanValue(begin, end, 0, type);
+    if (value_end == nullptr) {
+        return false;
+    }
+    // Trailing whitespace and a terminating NUL are fine, anything else is not
+    const char* p = SkipSpace(value_end, end);
+    if (p < end && !(*p == '\0' && p + 1 == end)) {
+        return false;
+    }
+    root = JsonView(type, begin, value_end - begin);
+    return true;
+}
+
+JsonView JsonView::Get(const char* key) const {
+    if (type_ != kJsonObject) {
+        return JsonView();
+    } else if (encoding_ == kEncodingCbor) {
+        return GetCbor(key);
+    }
+    const char* end = data_ + size_;
+    const char* p = SkipSpace(data_ + 1, end);
+    while (p < end && *p == '"') {
+        const char* key_end = ScanString(p, end);
+        bool match = StringEquals(p + 1, key_end - 1, key);
+        p = SkipSpace(SkipSpace(key_end, end) + 1, end);
+        JsonType type;
+        const char* value_end = ScanValue(p, end, 0, type);
+        if (match) {
+            return JsonView(type, p, value_end - p);
+        }
+        p = SkipSpace(value_end, end);
+        if (*p == ',') {
+            p = SkipSpace(p + 1, end);
+        }
+    }
+    return JsonView();
+}
+
+JsonView JsonView::At(size_t index) const {
+    if (type_ != kJsonArray) {
+        return JsonView();
+    } else if (encoding_ == kEncodingCbor) {
+        return AtCbor(index);
+    }
+    const char* end = data_ + size_;
+    const char* p = SkipSpace(data_ + 1, end);
+    for (size_t i = 0; p < end && *p != ']'; i++) {
+        JsonType type;
+        const char* value_end = ScanValue(p, end, 0, type);
+        if (i == index) {
+            return JsonView(type, p, value_end - p);
+        }
+        p = SkipSpace(value_end, end);
+        if (*p == ',') {
+            p = SkipSpace(p + 1, end);
+        }
+    }
+    return JsonView();
+}
+
+size_t JsonView::Size() const {
+    if (type_ != kJsonArray && type_ != kJsonObject) {
+        return 0;
+    } else if (encoding_ == kEncodingCbor) {
+        return SizeCbor();
+    }
+    const char* end = data_ + size_;
+    const char* p = SkipSpace(data_ + 1, end);
+    size_t count = 0;
+    while (p < end && *p != ']' && *p != '}') {
+        JsonType type;
+        if (type_ == kJsonObject) {
+            p = SkipSpace(SkipSpace(ScanString(p, end), end) + 1, end);
+        }
+        p = SkipSpace(ScanValue(p, end, 0, type), end);
+        if (*p == ',') {
+            p = SkipSpace(p + 1, end);
+        }
+        count++;
+    }
+    return count;
+}
+
+void JsonView::ForEach(const std::function<bool(const JsonView& key, const JsonView& value)>& visit) const {
+    if (type_ != kJsonArray && type_ != kJsonObject) {
+        return;
+    } else if (encoding_ == kEncodingCbor) {
+        ForEachCbor(visit);
+        return;
+    }
+    const char* end = data_ + size_;
+    const char* p = SkipSpace(data_ + 1, end);
+    while (p < end && *p != ']' && *p != '}') {
+        JsonView key;
+        if (type_ == kJsonObject) {
+            const char* key_end = ScanString(p, end);
+            key = JsonView(kJsonString, p, key_end - p);
+            p = SkipSpace(SkipSpace(key_end, end) + 1, end);
+        }
+        JsonType type;
+        const char* value_end = ScanValue(p, end, 0, type);
+        if (!visit(key, JsonView(type, p, value_end - p))) {
+            return;
+        }
+        p = SkipSpace(value_end, end);
+        if (*p == ',') {
+            p = SkipSpace(p + 1, end);
+        }
+    }
+}
+
+bool JsonView::Equals(const char* text) const {
+    if (type_ != kJsonString) {
+        return false;
+    } else if (encoding_ == kEncodingJson) {
+        return StringEquals(data_ + 1, data_ + size_ - 1, text);
+    }
+    size_t remaining = strlen(text);
+    bool equal = true;
+    ForEachCborChunk([&text, &remaining, &equal](const char* chunk, size_t length) {
+        if (length > remaining || memcmp(chunk, text, length) != 0) {
+            equal = false;
+            return false;
+        }
+        text += length;
+        remaining -= length;
+        return true;
+    });
+    return equal && remaining == 0;
+}
+
+std::string JsonView::ToString() const {
+    std::string text;
+    if (type_ != kJsonString) {
+        return text;
+    } else if (encoding_ != kEncodingJson) {
+        ForEachCborChunk([&text](const char* chunk, size_t length) {
+            text.append(chunk, length);
+            return true;
+        });
+        return text;
+    }
+    text.reserve(size_ - 2);
+    Unescape(data_ + 1, data_ + size_ - 1, [&text](char c) {
+        text += c;
+        return true;
+    });
+    return text;
+}
+
+double JsonView::ToNumber(double fallback) const {
+    if (type_ != kJsonNumber) {
+        return fallback;
+    } else if (encoding_ == kEncodingCbor) {
+        return ToNumberCbor(fallback);
+    }
+    // The view is not NUL terminated, numbers are short enough for the stack
+    char number[40];
+    if (size_ >= sizeof(number)) {
+        return fallback;
+    }
+    memcpy(number, data_, size_);
+    number[size_] = '\0';
+    return strtod(number, nullptr);
+}
+
+int JsonView::ToInt(int fallback) const {
+    if (type_ != kJsonNumber) {
+        return fallback;
+    }
+    double value = ToNumber(fallback);
+    if (value >= 2147483647.0) {
+        return 2147483647;
+    } else if (value <= -2147483648.0) {
+        return -2147483647 - 1;
+    }
+    return int(value);
+}
+
+bool JsonView::ToBool(bool fallback) const {
+    if (type_ == kJsonTrue) {
+        return true;
+    } else if (type_ == kJsonFalse) {
+        return false;
+    }
+    return fallback;
+}
+
+cJSON* JsonView::ToCjson() const {
+    if (type_ == kJsonNone) {
+        return nullptr;
+    } else if (encoding_ == kEncodingName) {
+        return cJSON_CreateString(ToString().c_str());
+    } else if (encoding_ == kEncodingCbor) {
+        std::string json;
+        if (!ControlItemToJson((const uint8_t*)data_, size_, envelope_, json)) {
+            return nullptr;
+        }
+        return cJSON_ParseWithLength(json.data(), json.size());
+    }
+    return cJSON_ParseWithLength(data_, size_);
+}
+
+bool JsonView::ParseCbor(const uint8_t* data, size_t size, JsonView& root) {
+    JsonType type;
+    if (size == 0 || (*data >> 5) != kCborMap || ScanCbor(data, data + size, 0, type) != data + size) {
+        return false;
+    }
+    root = JsonView(kJsonObject, (const char*)data, size, kEncodingCbor);
+    root.envelope_ = true;
+    return true;
+}
+
+// Lookups run on views validated by ParseCbor(), so they skip the error checks
+JsonView JsonView::GetCbor(const char* key) const {
+    auto p = (const uint8_t*)data_;
+    auto end = p + size_;
+    CborHead head;
+    p = ReadCborHead(p, end, head);
+    for (uint64_t i = 0; head.indefinite || i < head.value; i++) {
+        if (head.indefinite && *p == kCborBreak) {
+            break;
+        }
+        JsonType type;
+        CborHead key_head;
+        const uint8_t* key_begin = p;
+        bool match;
+        ReadCborHead(p, end, key_head);
+        p = ScanCbor(key_begin, end, 0, type);
+        if (key_head.major == kCborUnsigned) {
+            match = strcmp(ControlKeyName(key_head.value), key) == 0;
+        } else {
+            match = JsonView(kJsonString, (const char*)key_begin, p - key_begin, kEncodingCbor).Equals(key);
+        }
+        const uint8_t* value_end = ScanCbor(p, end, 0, type);
+        if (match) {
+            CborHead value;
+            ReadCborHead(p, end, value);
+            const char* name = nullptr;
+            if (envelope_ && value.major == kCborUnsigned && strcmp(key, "type") == 0) {
+                name = ControlTypeName(value.value);
+            }
+            if (name != nullptr) {
+                return JsonView(kJsonString, name, strlen(name), kEncodingName);
+            }
+            return JsonView(type, (const char*)p, value_end - p, kEncodingCbor);
+        }
+        p = value_end;
+    }
+    return JsonView();
+}
+
+JsonView JsonView::AtCbor(size_t index) const {
+    auto p = (const uint8_t*)data_;
+    auto end = p + size_;
+    CborHead head;
+    p = ReadCborHead(p, end, head);
+    for (uint64_t i = 0; head.indefinite || i < head.value; i++) {
+        if (head.indefinite && *p == kCborBreak) {
+            break;
+        }
+        JsonType type;
+        const uint8_t* value_end = ScanCbor(p, end, 0, type);
+        if (i == index) {
+            return JsonView(type, (const char*)p, value_end - p, kEncodingCbor);
+        }
+        p = value_end;
+    }
+    return JsonView();
+}
+
+size_t JsonView::SizeCbor() const {
+    auto p = (const uint8_t*)data_;
+    auto end = p + size_;
+    CborHead head;
+    p = ReadCborHead(p, end, head);
+    if (!head.indefinite) {
+        return head.value;
+    }
+    size_t count = 0;
+    while (*p != kCborBreak) {
+        JsonType type;
+        if (type_ == kJsonObject) {
+            p = ScanCbor(p, end, 0, type);
+        }
+        p = ScanCbor(p, end, 0, type);
+        count++;
+    }
+    return count;
+}
+
+void JsonView::ForEachCbor(const std::function<bool(const JsonView& key, const JsonView& value)>& visit) const {
+    auto p = (const uint8_t*)data_;
+    auto end = p + size_;
+    CborHead head;
+    p = ReadCborHead(p, end, head);
+    for (uint64_t i = 0; head.indefinite || i < head.value; i++) {
+        if (head.indefinite && *p == kCborBreak) {
+            break;
+        }
+        JsonType type;
+        JsonView key;
+        bool type_key = false;
+        if (type_ == kJsonObject) {
+            CborHead key_head;
+            const uint8_t* key_begin = p;
+            ReadCborHead(p, end, key_head);
+            p = ScanCbor(key_begin, end, 0, type);
+            if (key_head.major == kCborUnsigned) {
+                const char* name = ControlKeyName(key_head.value);
+                key = JsonView(kJsonString, name, strlen(name), kEncodingName);
+                type_key = key_head.value == kControlKeyType;
+            } else {
+                key = JsonView(kJsonString, (const char*)key_begin, p - key_begin, kEncodingCbor);
+                type_key = key.Equals("type");
+            }
+        }
+        const uint8_t* value_end = ScanCbor(p, end, 0, type);
+        JsonView value(type, (const char*)p, value_end - p, kEncodingCbor);
+        if (envelope_ && type_key) {
+            CborHead value_head;
+            ReadCborHead(p, end, value_head);
+            const char* name = value_head.major == kCborUnsigned ? ControlTypeName(value_head.value) : nullptr;
+            if (name != nullptr) {
+                value = JsonView(kJsonString, name, strlen(name), kEncodingName);
+            }
+        }
+        if (!visit(key, value)) {
+            return;
+        }
+        p = value_end;
+    }
+}
+
+double JsonView::ToNumberCbor(double fallback) const {
+    CborHead head;
+    ReadCborHead((const uint8_t*)data_, (const uint8_t*)data_ + size_, head);
+    switch (head.major) {
+        case kCborUnsigned:
+            return double(head.value);
+        case kCborNegative:
+            return head.value < INT64_MAX ? double(-1 - int64_t(head.value)) : -1.0 - double(head.value);
+        case kCborSimple:
+            return CborFloat(head);
+        default:
+            return fallback;
+    }
+}
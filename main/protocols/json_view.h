@@ -0,0 +1,90 @@
+#ifndef JSON_VIEW_H
+#define JSON_VIEW_H
+
+#include <cJSON.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+enum JsonType {
+    kJsonNone,  // Missing member, or a lookup on the wrong type
+    kJsonNull,
+    kJsonFalse,
+    kJsonTrue,
+    kJsonNumber,
+    kJsonString,
+    kJsonArray,
+    kJsonObject
+};
+
+// Read-only view of a value inside a JSON text, nothing is copied or allocated.
+// Parse() validates the whole text once, lookups then scan the buffer, which must
+// outlive the views. Accessors on a missing value or on the wrong type return
+// the empty value, so the result of Get() can be used without checking it.
+//
+// A binary control message (CBOR, see control_message.h) can be viewed the same way,
+// its integer keys and envelope type read as their names, so one dispatcher serves both.
+class JsonView {
+public:
+    JsonView() = default;
+
+    // Validates `data` as a single JSON value (depth limited) and returns its root view
+    static bool Parse(const char* data, size_t size, JsonView& root);
+    // Validates `data` as a binary control message and returns its root view
+    static bool ParseCbor(const uint8_t* data, size_t size, JsonView& root);
+
+    inline JsonType type() const { return type_; }
+    inline bool IsString() const { return type_ == kJsonString; }
+    inline bool IsObject() const { return type_ == kJsonObject; }
+    inline bool IsArray() const { return type_ == kJsonArray; }
+    inline explicit operator bool() const { return type_ != kJsonNone; }
+
+    // Member of an object, the first one if the key is repeated
+    JsonView Get(const char* key) const;
+    // Element of an array
+    JsonView At(size_t index) const;
+    size_t Size() const;
+    // Calls `visit` for each member of an object, or each element of an array with an
+    // empty key, in order. Stops when it returns false. One scan, unlike At() in a loop.
+    void ForEach(const std::function<bool(const JsonView& key, const JsonView& value)>& visit) const;
+
+    // True for a string value that decodes to `text`
+    bool Equals(const char* text) const;
+    // Decoded string value, empty for other types
+    std::string ToString() const;
+    double ToNumber(double fallback = 0) const;
+    int ToInt(int fallback = 0) const;
+    bool ToBool(bool fallback = false) const;
+
+    // Builds a cJSON tree of the value for APIs that take one, the caller deletes it
+    cJSON* ToCjson() const;
+
+private:
+    enum Encoding : uint8_t {
+        kEncodingJson,  // JSON text, quotes included for strings
+        kEncodingCbor,  // One CBOR item, its head included
+        kEncodingName   // Plain text, an envelope type decoded from its number
+    };
+
+    JsonType type_ = kJsonNone;
+    Encoding encoding_ = kEncodingJson;
+    // Root of a binary control message, only its "type" value is an enum
+    bool envelope_ = false;
+    const char* data_ = "";
+    size_t size_ = 0;
+
+    JsonView(JsonType type, const char* data, size_t size, Encoding encoding = kEncodingJson)
+        : type_(type), encoding_(encoding), data_(data), size_(size) {}
+
+    JsonView GetCbor(const char* key) const;
+    JsonView AtCbor(size_t index) const;
+    size_t SizeCbor() const;
+    void ForEachCbor(const std::function<bool(const JsonView& key, const JsonView& value)>& visit) const;
+    double ToNumberCbor(double fallback) const;
+    // Calls `chunk` for each piece of a string not in JSON text, stops when it returns false
+    template <typename Chunk>
+    void ForEachCborChunk(Chunk chunk) const;
+};
+
+#endif // JSON_VIEW_H
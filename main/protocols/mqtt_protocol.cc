@@ -4,6 +4,7 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <ml307_mqtt.h>
 #include <ml307_udp.h>
 #include <cstring>
@@ -60,24 +61,23 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
+        JsonView root;
+        if (!JsonView::Parse(payload.data(), payload.size(), root)) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
             return;
         }
-        cJSON* type = cJSON_GetObjectItem(root, "type");
-        if (type == nullptr) {
+        auto type = root.Get("type");
+        if (!type.IsString()) {
             ESP_LOGE(TAG, "Message type is not specified");
-            cJSON_Delete(root);
             return;
         }
 
-        if (strcmp(type->valuestring, "hello") == 0) {
+        if (type.Equals("hello")) {
             ParseServerHello(root);
-        } else if (strcmp(type->valuestring, "goodbye") == 0) {
-            auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+        } else if (type.Equals("goodbye")) {
+            auto session_id = root.Get("session_id");
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id.ToString().c_str() : "null");
+            if (!session_id || session_id.Equals(session_id_.c_str())) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
@@ -85,7 +85,6 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         } else if (on_incoming_json_ != nullptr) {
             on_incoming_json_(root);
         }
-        cJSON_Delete(root);
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -121,33 +120,132 @@ bool MqttProtocol::SendText(const std::string& text) {
     return true;
 }
 
-void MqttProtocol::SendAudio(const std::vector<uint8_t>& data) {
+void MqttProtocol::SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(data.size());
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + data.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
+    // The buffer keeps its capacity, so building a packet does not allocate
+    send_packet_.resize(MQTT_UDP_HEADER_SIZE + data.size());
+    auto packet = (uint8_t*)send_packet_.data();
+    memcpy(packet, aes_nonce_.data(), MQTT_UDP_HEADER_SIZE);
+    *(uint16_t*)&packet[2] = htons(data.size());
+    *(uint32_t*)&packet[12] = htonl(++local_sequence_);
+    auto payload = packet + MQTT_UDP_HEADER_SIZE;
+    memcpy(payload, data.data(), data.size());
+
+    // CTR advances the counter, so it runs on a copy and the header goes out as built
+    uint8_t counter[MQTT_UDP_HEADER_SIZE];
+    memcpy(counter, packet, MQTT_UDP_HEADER_SIZE);
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    int64_t start_time = esp_timer_get_time();
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, counter, stream_block, payload, payload) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return;
     }
+    uint32_t encrypt_us = esp_timer_get_time() - start_time;
+    send_stats_.sent++;
+    send_stats_.sent_bytes += send_packet_.size();
+    send_stats_.encrypt_us += encrypt_us;
+    if (encrypt_us > send_stats_.encrypt_max_us) {
+        send_stats_.encrypt_max_us = encrypt_us;
+    }
 
     busy_sending_audio_ = true;
-    udp_->Send(encrypted);
+    udp_->Send(send_packet_);
     busy_sending_audio_ = false;
 }
 
+bool MqttProtocol::AcceptSequence(uint32_t sequence) {
+    constexpr uint32_t kWindowMask = MQTT_UDP_REORDER_WINDOW >= 32 ? 0xffffffff : (1u << MQTT_UDP_REORDER_WINDOW) - 1;
+    int32_t delta = sequence - remote_sequence_;
+    if (remote_sequence_ == 0 || delta < -MQTT_UDP_RESYNC_GAP) {
+        if (remote_sequence_ != 0) {
+            ESP_LOGW(TAG, "Audio sequence jumped back from %lu to %lu", remote_sequence_, sequence);
+        }
+        // Nothing before the first packet counts as missing
+        remote_sequence_ = sequence;
+        receive_window_ = 1;
+        receive_window_valid_ = 1;
+        lost_history_ = 0;
+        return true;
+    }
+
+    if (delta > 0) {
+        // Slots shifted out of the window are final, the unset ones were lost
+        uint32_t shift = delta;
+        uint64_t missing = ~receive_window_ & receive_window_valid_ & kWindowMask;
+        if (shift >= MQTT_UDP_REORDER_WINDOW) {
+            // The sequences skipped over are lost too, they end up right behind the window
+            uint32_t gap = shift - MQTT_UDP_REORDER_WINDOW;
+            receive_stats_.lost += __builtin_popcountll(missing) + gap;
+            if (gap >= 64) {
+                lost_history_ = UINT64_MAX;
+            } else {
+                lost_history_ = ((missing | (lost_history_ << MQTT_UDP_REORDER_WINDOW)) << gap) | ((1ull << gap) - 1);
+            }
+            receive_window_ = 1;
+            receive_window_valid_ = kWindowMask;
+        } else {
+            uint32_t leaving = kWindowMask & ~(kWindowMask >> shift);
+            receive_stats_.lost += __builtin_popcount(missing & leaving);
+            lost_history_ = (lost_history_ << shift) | (missing >> (MQTT_UDP_REORDER_WINDOW - shift));
+            receive_window_ = ((receive_window_ << shift) | 1) & kWindowMask;
+            // Everything between the previous newest packet and this one is after the first
+            receive_window_valid_ = ((receive_window_valid_ << shift) | ((1u << shift) - 1)) & kWindowMask;
+        }
+        remote_sequence_ = sequence;
+        return true;
+    }
+
+    uint32_t age = -delta;
+    if (age >= MQTT_UDP_REORDER_WINDOW) {
+        uint32_t index = age - MQTT_UDP_REORDER_WINDOW;
+        if (index < 64 && (lost_history_ & (1ull << index))) {
+            // Not lost after all, only too late to be played
+            lost_history_ &= ~(1ull << index);
+            receive_stats_.lost--;
+        }
+        receive_stats_.late++;
+        return false;
+    }
+    if (receive_window_ & (1u << age)) {
+        receive_stats_.duplicate++;
+        return false;
+    }
+    // May be older than the first packet, e.g. the first two were swapped
+    receive_window_ |= 1u << age;
+    receive_window_valid_ |= 1u << age;
+    receive_stats_.reordered++;
+    return true;
+}
+
+void MqttProtocol::PrintStats() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed_ms = (now - stats_start_time_) / 1000;
+    if (send_stats_.sent > 0 && elapsed_ms > 0) {
+        ESP_LOGI(TAG, "UDP: sent %lu packets %lu bytes, %lu.%lu packets/s, encrypt avg %lu us max %lu us",
+            send_stats_.sent, send_stats_.sent_bytes, (uint32_t)(send_stats_.sent * 1000 / elapsed_ms),
+            (uint32_t)(send_stats_.sent * 10000 / elapsed_ms % 10), send_stats_.encrypt_us / send_stats_.sent,
+            send_stats_.encrypt_max_us);
+    }
+    send_stats_ = UdpSendStats();
+    stats_start_time_ = now;
+
+    UdpReceiveStats total = receive_stats_.Load();
+    auto& last = printed_receive_stats_;
+    if (total.received != last.received) {
+        // Lost can be negative, when packets counted as lost before arrived late since
+        ESP_LOGI(TAG, "UDP: received %lu reordered %lu duplicate %lu late %lu lost %ld",
+            total.received - last.received, total.reordered - last.reordered, total.duplicate - last.duplicate,
+            total.late - last.late, (int32_t)(total.lost - last.lost));
+    }
+    last = total;
+}
+
 void MqttProtocol::CloseAudioChannel() {
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
@@ -186,8 +284,11 @@ bool MqttProtocol::OpenAudioChannel() {
     message += "\"type\":\"hello\",";
     message += "\"version\": 3,";
     message += "\"transport\":\"udp\",";
+    if (!iot_descriptors_hash_.empty()) {
+        message += "\"iot_descriptors_hash\":\"" + iot_descriptors_hash_ + "\",";
+    }
     message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
+    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(frame_duration_);
     message += "}}";
     if (!SendText(message)) {
         return false;
@@ -206,8 +307,12 @@ bool MqttProtocol::OpenAudioChannel() {
         delete udp_;
     }
     udp_ = Board::GetInstance().CreateUdp();
+    send_packet_.reserve(MQTT_UDP_PACKET_CAPACITY);
+    // The packet rate is measured from here, not from the last print before the channel opened
+    send_stats_ = UdpSendStats();
+    stats_start_time_ = esp_timer_get_time();
     udp_->OnMessage([this](const std::string& data) {
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < MQTT_UDP_HEADER_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
@@ -216,30 +321,27 @@ bool MqttProtocol::OpenAudioChannel() {
             return;
         }
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        if (!AcceptSequence(sequence)) {
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        std::vector<uint8_t> decrypted;
-        size_t decrypted_size = data.size() - aes_nonce_.size();
+        // CTR advances the counter, so it runs on a copy instead of the received header
+        uint8_t counter[MQTT_UDP_HEADER_SIZE];
+        memcpy(counter, data.data(), MQTT_UDP_HEADER_SIZE);
+        size_t payload_size = data.size() - MQTT_UDP_HEADER_SIZE;
+        receive_buffer_.resize(payload_size);
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        decrypted.resize(decrypted_size);
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)decrypted.data());
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, counter, stream_block,
+            (const uint8_t*)data.data() + MQTT_UDP_HEADER_SIZE, receive_buffer_.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
         }
+        receive_stats_.received++;
         if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(decrypted));
+            on_incoming_audio_(sequence, 0, std::move(receive_buffer_));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -251,49 +353,47 @@ bool MqttProtocol::OpenAudioChannel() {
     return true;
 }
 
-void MqttProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "udp") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+void MqttProtocol::ParseServerHello(const JsonView& root) {
+    auto transport = root.Get("transport");
+    if (!transport.Equals("udp")) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", transport.ToString().c_str());
         return;
     }
 
-    auto session_id = cJSON_GetObjectItem(root, "session_id");
-    if (session_id != nullptr) {
-        session_id_ = session_id->valuestring;
+    auto session_id = root.Get("session_id");
+    if (session_id.IsString()) {
+        session_id_ = session_id.ToString();
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
     // Get sample rate from hello message
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (frame_duration != NULL) {
-            server_frame_duration_ = frame_duration->valueint;
-        }
-    }
+    ParseAudioParams(root.Get("audio_params"));
+    server_iot_descriptors_hash_ = root.Get("iot_descriptors_hash").ToString();
 
-    auto udp = cJSON_GetObjectItem(root, "udp");
-    if (udp == nullptr) {
+    auto udp = root.Get("udp");
+    if (!udp.IsObject()) {
         ESP_LOGE(TAG, "UDP is not specified");
         return;
     }
-    udp_server_ = cJSON_GetObjectItem(udp, "server")->valuestring;
-    udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
-    auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
-    auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
+    udp_server_ = udp.Get("server").ToString();
+    udp_port_ = udp.Get("port").ToInt();
+    auto key = udp.Get("key").ToString();
+    auto nonce = udp.Get("nonce").ToString();
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
     aes_nonce_ = DecodeHexString(nonce);
+    if (aes_nonce_.size() != MQTT_UDP_HEADER_SIZE) {
+        ESP_LOGE(TAG, "Invalid UDP nonce of %zu bytes", aes_nonce_.size());
+        return;
+    }
     mbedtls_aes_init(&aes_ctx_);
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
     remote_sequence_ = 0;
+    receive_window_ = 0;
+    receive_window_valid_ = 0;
+    lost_history_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -10,6 +10,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#include <atomic>
 #include <functional>
 #include <string>
 #include <map>
@@ -20,16 +21,66 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// UDP audio packet: 16 byte header (the session nonce with size and sequence filled in), then the AES-CTR payload
+#define MQTT_UDP_HEADER_SIZE 16
+// Capacity reserved for the packet buffer, larger packets still work but reallocate once
+#define MQTT_UDP_PACKET_CAPACITY 1024
+
+// Late packets within this many frames of the newest one are still passed on, at most 32
+#define MQTT_UDP_REORDER_WINDOW 8
+// A sequence this far behind means the server restarted its numbering
+#define MQTT_UDP_RESYNC_GAP 500
+
+struct UdpSendStats {
+    uint32_t sent = 0;
+    uint32_t sent_bytes = 0;
+    uint32_t encrypt_us = 0;      // Total over the sent packets
+    uint32_t encrypt_max_us = 0;
+};
+
+// Every sequence is counted once. A packet that arrives behind the window was counted
+// as lost when its slot left the window, it is moved from `lost` to `late` then, so
+// `lost` can go down between two prints. `late` is what a wider window would recover.
+// Only the last 64 sequences behind the window are remembered, a packet older than
+// that is counted as late and stays in `lost`.
+struct UdpReceiveStats {
+    uint32_t received = 0;        // Passed on, reordered ones included
+    uint32_t reordered = 0;       // Older than the newest packet but within the reorder window
+    uint32_t duplicate = 0;       // Discarded
+    uint32_t late = 0;            // Behind the reorder window, discarded
+    uint32_t lost = 0;            // Left the reorder window without arriving
+};
+
+// Written by the UDP receive task, read by PrintStats() from another task
+struct UdpReceiveCounters {
+    std::atomic<uint32_t> received{0};
+    std::atomic<uint32_t> reordered{0};
+    std::atomic<uint32_t> duplicate{0};
+    std::atomic<uint32_t> late{0};
+    std::atomic<uint32_t> lost{0};
+
+    UdpReceiveStats Load() const {
+        UdpReceiveStats stats;
+        stats.received = received;
+        stats.reordered = reordered;
+        stats.duplicate = duplicate;
+        stats.late = late;
+        stats.lost = lost;
+        return stats;
+    }
+};
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
     ~MqttProtocol();
 
     bool Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    void SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    void PrintStats() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -49,9 +100,30 @@ private:
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    // Every packet is built and encrypted in place here. Sends are serialized by channel_mutex_
+    // and Udp::Send copies before returning, so a single buffer is the whole pool.
+    std::string send_packet_;
+    // Same for received packets, only touched by the UDP receive task. It keeps its capacity
+    // as long as the audio callback does not move the data out.
+    std::vector<uint8_t> receive_buffer_;
+    // Bit i is set when remote_sequence_ - i has arrived
+    uint32_t receive_window_ = 0;
+    // Bit i is set when remote_sequence_ - i is not older than the first packet, only those can be lost
+    uint32_t receive_window_valid_ = 0;
+    // Bit i is set when remote_sequence_ - MQTT_UDP_REORDER_WINDOW - i was counted as lost
+    uint64_t lost_history_ = 0;
+    // Since the last PrintStats
+    UdpSendStats send_stats_;
+    int64_t stats_start_time_ = 0;
+    // Running totals, printed as differences
+    UdpReceiveCounters receive_stats_;
+    UdpReceiveStats printed_receive_stats_;
+
+    // Updates the reorder window, false if the packet must be discarded
+    bool AcceptSequence(uint32_t sequence);
 
     bool StartMqttClient(bool report_error=false);
-    void ParseServerHello(const cJSON* root);
+    void ParseServerHello(const JsonView& root);
     std::string DecodeHexString(const std::string& hex_string);
 
     bool SendText(const std::string& text) override;
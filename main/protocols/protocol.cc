@@ -1,14 +1,15 @@
 #include "protocol.h"
+#include "control_message.h"
 
 #include <esp_log.h>
 
 #define TAG "Protocol"
 
-void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
+void Protocol::OnIncomingJson(std::function<void(const JsonView& root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
+void Protocol::OnIncomingAudio(std::function<void(uint32_t sequence, uint32_t timestamp, std::vector<uint8_t>&& data)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -31,88 +32,108 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
+bool Protocol::SendBinaryControl(const std::vector<uint8_t>& data) {
+    ESP_LOGE(TAG, "Binary control messages are not supported by this transport");
+    return false;
+}
+
+bool Protocol::SendControl(ControlMessageWriter& message) {
+    if (message.binary()) {
+        return SendBinaryControl(message.data());
+    }
+    return SendText(message.text());
+}
+
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    ControlMessageWriter message(binary_control_);
+    message.Add("session_id", session_id_).Add("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        message.Add("reason", "wake_word_detected");
     }
-    message += "}";
-    SendText(message);
+    SendControl(message);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    ControlMessageWriter message(binary_control_);
+    message.Add("session_id", session_id_).Add("type", "listen").Add("state", "detect").Add("text", wake_word);
+    SendControl(message);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    ControlMessageWriter message(binary_control_);
+    message.Add("session_id", session_id_).Add("type", "listen").Add("state", "start");
     if (mode == kListeningModeRealtime) {
-        message += ",\"mode\":\"realtime\"";
+        message.Add("mode", "realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        message.Add("mode", "auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        message.Add("mode", "manual");
     }
-    message += "}";
-    SendText(message);
+    SendControl(message);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    ControlMessageWriter message(binary_control_);
+    message.Add("session_id", session_id_).Add("type", "listen").Add("state", "stop");
+    SendControl(message);
 }
 
-void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    cJSON* root = cJSON_Parse(descriptors.c_str());
-    if (root == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse IoT descriptors: %s", descriptors.c_str());
-        return;
+void Protocol::SetIotDescriptors(const std::vector<std::string>& descriptors, const std::string& hash) {
+    iot_descriptors_hash_ = hash;
+    // Serialized once in both encodings, the session id is put in front when sending
+    iot_descriptor_bodies_.clear();
+    iot_descriptor_binary_bodies_.clear();
+    for (auto& descriptor : descriptors) {
+        // One descriptor per message
+        std::string json = "[" + descriptor + "]";
+        ControlMessageWriter body(false);
+        body.Add("type", "iot").Add("update", true).AddJson("descriptors", json);
+        iot_descriptor_bodies_.push_back(std::move(body));
+        ControlMessageWriter binary_body(true);
+        binary_body.Add("type", "iot").Add("update", true).AddJson("descriptors", json);
+        iot_descriptor_binary_bodies_.push_back(std::move(binary_body));
     }
+}
 
-    if (!cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "IoT descriptors should be an array");
-        cJSON_Delete(root);
+void Protocol::SendIotDescriptors() {
+    if (!iot_descriptors_hash_.empty() && server_iot_descriptors_hash_ == iot_descriptors_hash_) {
+        ESP_LOGI(TAG, "Server already has IoT descriptors %s", iot_descriptors_hash_.c_str());
         return;
     }
 
-    int arraySize = cJSON_GetArraySize(root);
-    for (int i = 0; i < arraySize; ++i) {
-        cJSON* descriptor = cJSON_GetArrayItem(root, i);
-        if (descriptor == nullptr) {
-            ESP_LOGE(TAG, "Failed to get IoT descriptor at index %d", i);
-            continue;
-        }
-
-        cJSON* messageRoot = cJSON_CreateObject();
-        cJSON_AddStringToObject(messageRoot, "session_id", session_id_.c_str());
-        cJSON_AddStringToObject(messageRoot, "type", "iot");
-        cJSON_AddBoolToObject(messageRoot, "update", true);
-
-        cJSON* descriptorArray = cJSON_CreateArray();
-        cJSON_AddItemToArray(descriptorArray, cJSON_Duplicate(descriptor, 1));
-        cJSON_AddItemToObject(messageRoot, "descriptors", descriptorArray);
-
-        char* message = cJSON_PrintUnformatted(messageRoot);
-        if (message == nullptr) {
-            ESP_LOGE(TAG, "Failed to print JSON message for IoT descriptor at index %d", i);
-            cJSON_Delete(messageRoot);
-            continue;
-        }
-
-        SendText(std::string(message));
-        cJSON_free(message);
-        cJSON_Delete(messageRoot);
+    for (auto& body : binary_control_ ? iot_descriptor_binary_bodies_ : iot_descriptor_bodies_) {
+        ControlMessageWriter message(binary_control_);
+        message.Add("session_id", session_id_).Append(body);
+        SendControl(message);
     }
-
-    cJSON_Delete(root);
 }
 
 void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
-    SendText(message);
+    ControlMessageWriter message(binary_control_);
+    message.Add("session_id", session_id_).Add("type", "iot").Add("update", true).AddJson("states", states);
+    SendControl(message);
+}
+
+void Protocol::SendStats(const std::string& stats) {
+    ControlMessageWriter message(binary_control_);
+    message.Add("session_id", session_id_).Add("type", "stats").AddJson("stats", stats);
+    SendControl(message);
+}
+
+void Protocol::ParseAudioParams(const JsonView& audio_params) {
+    server_sample_rate_ = audio_params.Get("sample_rate").ToInt(server_sample_rate_);
+    server_frame_duration_ = audio_params.Get("frame_duration").ToInt(server_frame_duration_);
+    // Servers that do not negotiate the uplink only decode the 60ms frames of older firmware
+    int uplink_frame_duration = audio_params.Get("uplink_frame_duration").ToInt(60);
+    if (uplink_frame_duration != 20 && uplink_frame_duration != 40 && uplink_frame_duration != 60) {
+        ESP_LOGW(TAG, "Unsupported uplink frame duration %d ms, using 60 ms", uplink_frame_duration);
+        uplink_frame_duration = 60;
+    }
+    uplink_frame_duration_ = uplink_frame_duration;
+    if (uplink_frame_duration_ != frame_duration_) {
+        ESP_LOGW(TAG, "Server accepted %d ms uplink frames instead of %d ms",
+            uplink_frame_duration_, frame_duration_);
+    }
 }
 
 bool Protocol::IsTimeout() const {
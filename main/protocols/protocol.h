@@ -1,11 +1,26 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include "json_view.h"
+#include "control_message.h"
+
 #include <cJSON.h>
 #include <string>
+#include <vector>
 #include <functional>
 #include <chrono>
 
+// WebSocket audio frame of binary protocol version 2, negotiated in hello. Big-endian.
+struct BinaryProtocol2 {
+    uint16_t version;
+    uint16_t type;            // 0: Opus, 1: CBOR control message (binary control protocol only)
+    uint32_t sequence;        // Incremented by one per frame
+    uint32_t timestamp;       // Milliseconds on the sender's clock, capture time of the frame
+    uint16_t frame_duration;  // Milliseconds
+    uint16_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
 struct BinaryProtocol3 {
     uint8_t type;
     uint8_t reserved;
@@ -37,9 +52,22 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // Duration of the uplink Opus frames, announced in hello when the channel opens
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
+    // Uplink frame duration accepted by the server hello, the session must encode with it
+    inline int uplink_frame_duration() const {
+        return uplink_frame_duration_;
+    }
+    void SetFrameDuration(int frame_duration) {
+        frame_duration_ = frame_duration;
+    }
 
-    void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
-    void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // `timestamp` is the sender's frame time in milliseconds, 0 if the transport does not carry it
+    void OnIncomingAudio(std::function<void(uint32_t sequence, uint32_t timestamp, std::vector<uint8_t>&& data)> callback);
+    // `root` is a view of the received text, only valid during the callback
+    void OnIncomingJson(std::function<void(const JsonView& root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
@@ -49,29 +77,50 @@ public:
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool IsAudioChannelBusy() const;
-    virtual void SendAudio(const std::vector<uint8_t>& data) = 0;
+    // `timestamp` is the capture time in milliseconds, sent where the framing has room for it
+    virtual void SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp = 0) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
-    virtual void SendIotDescriptors(const std::string& descriptors);
+    // Descriptors do not change at runtime, they are framed once per session and encoding
+    void SetIotDescriptors(const std::vector<std::string>& descriptors, const std::string& hash);
+    // Skipped when the server hello acknowledged the hash
+    virtual void SendIotDescriptors();
     virtual void SendIotStates(const std::string& states);
+    virtual void SendStats(const std::string& stats);
+    // Logs transport specific statistics, called periodically
+    virtual void PrintStats() {}
 
 protected:
-    std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio_;
+    std::function<void(const JsonView& root)> on_incoming_json_;
+    std::function<void(uint32_t sequence, uint32_t timestamp, std::vector<uint8_t>&& data)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int frame_duration_ = 60;
+    int uplink_frame_duration_ = 60;
     bool error_occurred_ = false;
     bool busy_sending_audio_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    // Control messages go out CBOR encoded, only if the server hello accepted it
+    bool binary_control_ = false;
+    // Announced in the client hello, the server hello echoes it when it has the descriptors
+    std::string iot_descriptors_hash_;
+    std::string server_iot_descriptors_hash_;
+    // Session independent part of the descriptor messages, in each encoding
+    std::vector<ControlMessageWriter> iot_descriptor_bodies_;
+    std::vector<ControlMessageWriter> iot_descriptor_binary_bodies_;
 
     virtual bool SendText(const std::string& text) = 0;
+    virtual bool SendBinaryControl(const std::vector<uint8_t>& data);
+    bool SendControl(ControlMessageWriter& message);
+    // Reads "audio_params" of the server hello
+    void ParseAudioParams(const JsonView& audio_params);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
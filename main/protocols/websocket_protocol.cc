@@ -1,4 +1,5 @@
 #include "websocket_protocol.h"
+#include "control_message.h"
 #include "board.h"
 #include "system_info.h"
 #include "application.h"
@@ -28,22 +29,42 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
-void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data) {
+void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr) {
         return;
     }
 
     busy_sending_audio_ = true;
-    websocket_->Send(data.data(), data.size(), true);
+    if (binary_version_ == 2) {
+        // The buffer keeps its capacity, so framing does not allocate after the first packet
+        send_buffer_.resize(sizeof(BinaryProtocol2) + data.size());
+        auto bp2 = (BinaryProtocol2*)send_buffer_.data();
+        bp2->version = htons(2);
+        bp2->type = 0;
+        bp2->sequence = htonl(++local_sequence_);
+        bp2->timestamp = htonl(timestamp);
+        bp2->frame_duration = htons(uplink_frame_duration_);
+        bp2->payload_size = htons(data.size());
+        memcpy(bp2->payload, data.data(), data.size());
+        websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
+    } else {
+        websocket_->Send(data.data(), data.size(), true);
+    }
     busy_sending_audio_ = false;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
-    if (websocket_ == nullptr) {
-        return false;
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ == nullptr) {
+            return false;
+        }
+        sent = websocket_->Send(text);
     }
 
-    if (!websocket_->Send(text)) {
+    if (!sent) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
@@ -52,11 +73,63 @@ bool WebsocketProtocol::SendText(const std::string& text) {
     return true;
 }
 
+bool WebsocketProtocol::SendBinaryControl(const std::vector<uint8_t>& data) {
+    bool sent;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ == nullptr) {
+            return false;
+        }
+        // Control frames share the audio framing but not its sequence numbers
+        send_buffer_.resize(sizeof(BinaryProtocol2) + data.size());
+        auto bp2 = (BinaryProtocol2*)send_buffer_.data();
+        bp2->version = htons(2);
+        bp2->type = htons(1);
+        bp2->sequence = 0;
+        bp2->timestamp = 0;
+        bp2->frame_duration = 0;
+        bp2->payload_size = htons(data.size());
+        memcpy(bp2->payload, data.data(), data.size());
+        sent = websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
+    }
+
+    if (!sent) {
+        ESP_LOGE(TAG, "Failed to send control message of %zu bytes", data.size());
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+
+    return true;
+}
+
+void WebsocketProtocol::HandleIncomingControl(const char* data, size_t size) {
+    JsonView root;
+    if (!JsonView::Parse(data, size, root)) {
+        ESP_LOGE(TAG, "Invalid JSON, data: %.*s", (int)size, data);
+        return;
+    }
+    DispatchControl(root);
+}
+
+void WebsocketProtocol::DispatchControl(const JsonView& root) {
+    auto type = root.Get("type");
+    if (!type.IsString()) {
+        ESP_LOGE(TAG, "Missing message type");
+        return;
+    }
+    if (type.Equals("hello")) {
+        ParseServerHello(root);
+    } else if (on_incoming_json_ != nullptr) {
+        on_incoming_json_(root);
+    }
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
     return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ != nullptr) {
         delete websocket_;
         websocket_ = nullptr;
@@ -64,49 +137,60 @@ void WebsocketProtocol::CloseAudioChannel() {
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
-    if (websocket_ != nullptr) {
-        delete websocket_;
-    }
-
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
 
     busy_sending_audio_ = false;
     error_occurred_ = false;
-    
+    remote_sequence_ = 0;
+    local_sequence_ = 0;
+    binary_version_ = 1;
+    binary_control_ = false;
+
     // If token not starts with "Bearer " or "bearer ", add it
     if (token.empty() || (token.find("Bearer ") != 0 && token.find("bearer ") != 0)) {
         token = "Bearer " + token;
     }
 
-    websocket_ = Board::GetInstance().CreateWebSocket();
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ != nullptr) {
+            delete websocket_;
+        }
+        websocket_ = Board::GetInstance().CreateWebSocket();
+    }
     websocket_->SetHeader("Authorization", token.c_str());
-    websocket_->SetHeader("Protocol-Version", "1");
+    websocket_->SetHeader("Protocol-Version", std::to_string(WEBSOCKET_PROTOCOL_VERSION).c_str());
     websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
     websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
-                on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
-            }
-        } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (type != NULL) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
+            if (binary_version_ == 2) {
+                auto bp2 = (const BinaryProtocol2*)data;
+                if (len < sizeof(BinaryProtocol2) || ntohs(bp2->version) != 2 || ntohs(bp2->type) > 1 ||
+                    ntohs(bp2->payload_size) > len - sizeof(BinaryProtocol2)) {
+                    ESP_LOGE(TAG, "Invalid binary frame of %zu bytes", len);
+                } else if (ntohs(bp2->type) == 1) {
+                    // CBOR control message, its fields are read in place
+                    JsonView root;
+                    if (JsonView::ParseCbor(bp2->payload, ntohs(bp2->payload_size), root)) {
+                        DispatchControl(root);
+                    } else {
+                        ESP_LOGE(TAG, "Invalid control message of %u bytes", ntohs(bp2->payload_size));
                     }
+                } else if (on_incoming_audio_ != nullptr) {
+                    on_incoming_audio_(ntohl(bp2->sequence), ntohl(bp2->timestamp),
+                        std::vector<uint8_t>(bp2->payload, bp2->payload + ntohs(bp2->payload_size)));
                 }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+            } else if (on_incoming_audio_ != nullptr) {
+                // Version 1 carries no sequence number, WebSocket is ordered so number the frames on arrival
+                on_incoming_audio_(++remote_sequence_, 0, std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
             }
-            cJSON_Delete(root);
+        } else {
+            // JSON control messages are still accepted with the binary control protocol
+            HandleIncomingControl(data, len);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
@@ -129,10 +213,13 @@ bool WebsocketProtocol::OpenAudioChannel() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
     std::string message = "{";
     message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
+    message += "\"version\": " + std::to_string(WEBSOCKET_PROTOCOL_VERSION) + ",";
     message += "\"transport\":\"websocket\",";
+    if (!iot_descriptors_hash_.empty()) {
+        message += "\"iot_descriptors_hash\":\"" + iot_descriptors_hash_ + "\",";
+    }
     message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
+    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(frame_duration_);
     message += "}}";
     if (!SendText(message)) {
         return false;
@@ -153,24 +240,23 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
-void WebsocketProtocol::ParseServerHello(const cJSON* root) {
-    auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+void WebsocketProtocol::ParseServerHello(const JsonView& root) {
+    auto transport = root.Get("transport");
+    if (!transport.Equals("websocket")) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", transport.ToString().c_str());
         return;
     }
 
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (audio_params != NULL) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (sample_rate != NULL) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (frame_duration != NULL) {
-            server_frame_duration_ = frame_duration->valueint;
-        }
+    // The server confirms the protocol version it is going to use, version 3 adds CBOR control messages
+    int version = root.Get("version").ToInt();
+    if (version >= 2 && version <= WEBSOCKET_PROTOCOL_VERSION) {
+        binary_version_ = 2;
+        binary_control_ = version == 3;
     }
+    ESP_LOGI(TAG, "Binary protocol version %d, %s control messages", binary_version_, binary_control_ ? "CBOR" : "JSON");
+
+    ParseAudioParams(root.Get("audio_params"));
+    server_iot_descriptors_hash_ = root.Get("iot_descriptors_hash").ToString();
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
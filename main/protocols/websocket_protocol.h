@@ -8,25 +8,45 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#include <mutex>
+
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+#if CONFIG_USE_WEBSOCKET_BINARY_CONTROL
+#define WEBSOCKET_PROTOCOL_VERSION 3
+#elif CONFIG_USE_WEBSOCKET_BINARY_PROTOCOL_V2
+#define WEBSOCKET_PROTOCOL_VERSION 2
+#else
+#define WEBSOCKET_PROTOCOL_VERSION 1
+#endif
+
 class WebsocketProtocol : public Protocol {
 public:
     WebsocketProtocol();
     ~WebsocketProtocol();
 
     bool Start() override;
-    void SendAudio(const std::vector<uint8_t>& data) override;
+    void SendAudio(const std::vector<uint8_t>& data, uint32_t timestamp) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
+    // Audio is sent from the uplink task, text from the main loop
+    std::mutex channel_mutex_;
     WebSocket* websocket_ = nullptr;
-
-    void ParseServerHello(const cJSON* root);
+    uint32_t remote_sequence_ = 0;
+    // Framing of binary messages, version 2 only if the server hello accepted version 2 or 3
+    int binary_version_ = 1;
+    uint32_t local_sequence_ = 0;
+    std::vector<uint8_t> send_buffer_;
+
+    void ParseServerHello(const JsonView& root);
+    void HandleIncomingControl(const char* data, size_t size);
+    void DispatchControl(const JsonView& root);
     bool SendText(const std::string& text) override;
+    bool SendBinaryControl(const std::vector<uint8_t>& data) override;
 };
 
 #endif
@@ -0,0 +1,98 @@
+#include "resumable_tls_transport.h"
+#include "tls_session_cache.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_crt_bundle.h>
+#include <cstring>
+
+#define TAG "ResumableTls"
+
+ResumableTlsTransport::~ResumableTlsTransport() {
+    Disconnect();
+}
+
+bool ResumableTlsTransport::Connect(const char* host, int port) {
+    Disconnect();
+
+    auto& cache = TlsSessionCache::GetInstance();
+    esp_tls_cfg_t cfg = {};
+    cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    bool offered = false;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // Held until the handshake is done, so another connect cannot free it meanwhile
+    auto session = cache.Find(host, port);
+    cfg.client_session = session.get();
+    offered = session != nullptr;
+#endif
+
+    tls_client_ = esp_tls_init();
+    if (tls_client_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to initialize TLS");
+        return false;
+    }
+
+    auto start_time = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, tls_client_) != 1) {
+        ESP_LOGE(TAG, "Failed to connect to %s:%d", host, port);
+        esp_tls_conn_destroy(tls_client_);
+        tls_client_ = nullptr;
+        if (offered) {
+            // The server may have forgotten the session, start from a full handshake next time
+            cache.Remove(host, port);
+        }
+        return false;
+    }
+    auto duration_ms = (esp_timer_get_time() - start_time) / 1000;
+    cache.RecordHandshake(offered, duration_ms);
+    ESP_LOGI(TAG, "Connected to %s:%d in %lld ms%s", host, port, duration_ms, offered ? " (session offered)" : "");
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // Keep the newest session, a resumed one may come with a fresh ticket
+    cache.Store(host, port, esp_tls_get_client_session(tls_client_));
+#endif
+    connected_ = true;
+    return true;
+}
+
+void ResumableTlsTransport::Disconnect() {
+    if (tls_client_ != nullptr) {
+        esp_tls_conn_destroy(tls_client_);
+        tls_client_ = nullptr;
+    }
+    connected_ = false;
+}
+
+int ResumableTlsTransport::Send(const char* data, size_t length) {
+    if (tls_client_ == nullptr) {
+        return -1;
+    }
+    size_t total_sent = 0;
+    while (total_sent < length) {
+        int ret = esp_tls_conn_write(tls_client_, data + total_sent, length - total_sent);
+        if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Send failed: %d", ret);
+            connected_ = false;
+            return ret;
+        }
+        total_sent += ret;
+    }
+    return total_sent;
+}
+
+int ResumableTlsTransport::Receive(char* buffer, size_t buffer_size) {
+    if (tls_client_ == nullptr) {
+        return -1;
+    }
+    int ret;
+    do {
+        ret = esp_tls_conn_read(tls_client_, buffer, buffer_size);
+    } while (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE);
+    if (ret <= 0) {
+        connected_ = false;
+    }
+    return ret;
+}
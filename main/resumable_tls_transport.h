@@ -0,0 +1,24 @@
+#ifndef RESUMABLE_TLS_TRANSPORT_H
+#define RESUMABLE_TLS_TRANSPORT_H
+
+#include <transport.h>
+#include <esp_tls.h>
+
+#include <string>
+
+// TLS transport for WebSocket and friends that resumes sessions through TlsSessionCache,
+// otherwise the same as TlsTransport: certificates are verified with the bundle.
+class ResumableTlsTransport : public Transport {
+public:
+    ~ResumableTlsTransport();
+
+    bool Connect(const char* host, int port) override;
+    void Disconnect() override;
+    int Send(const char* data, size_t length) override;
+    int Receive(char* buffer, size_t buffer_size) override;
+
+private:
+    esp_tls_t* tls_client_ = nullptr;
+};
+
+#endif // RESUMABLE_TLS_TRANSPORT_H
@@ -0,0 +1,131 @@
+#include "sound_cache.h"
+#include "protocol.h"
+#include "audio_resampler.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <arpa/inet.h>
+#include <opus_decoder.h>
+
+#include <algorithm>
+#include <vector>
+
+#define TAG "SoundCache"
+
+// The assets are encoded at 16000Hz, 60ms frame duration
+#define SOUND_ASSET_SAMPLE_RATE 16000
+#define SOUND_ASSET_FRAME_DURATION_MS 60
+
+CachedSound::~CachedSound() {
+    if (pcm != nullptr) {
+        heap_caps_free(pcm);
+    }
+}
+
+SoundCache::SoundCache(size_t max_bytes) : max_bytes_(max_bytes) {
+    enabled_ = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+}
+
+std::shared_ptr<const CachedSound> SoundCache::Find(const std::string_view& sound, int sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = sounds_.begin(); it != sounds_.end(); ++it) {
+        if ((*it)->key == sound.data() && (*it)->sample_rate == sample_rate) {
+            sounds_.splice(sounds_.begin(), sounds_, it);
+            return sounds_.front();
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const CachedSound> SoundCache::Load(const std::string_view& sound, int sample_rate) {
+    if (!enabled_) {
+        return nullptr;
+    }
+    auto cached = Find(sound, sample_rate);
+    if (cached) {
+        return cached;
+    }
+
+    auto decoded = Decode(sound, sample_rate);
+    if (!decoded) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t size = decoded->samples * sizeof(int16_t);
+    // Sounds being played hold their own reference, evicting them here is safe
+    while (!sounds_.empty() && bytes_ + size > max_bytes_) {
+        bytes_ -= sounds_.back()->samples * sizeof(int16_t);
+        sounds_.pop_back();
+    }
+    sounds_.push_front(decoded);
+    bytes_ += size;
+    return decoded;
+}
+
+void SoundCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sounds_.clear();
+    bytes_ = 0;
+}
+
+std::shared_ptr<CachedSound> SoundCache::Decode(const std::string_view& sound, int sample_rate) {
+    auto start_time = esp_timer_get_time();
+
+    // Count the packets first so the PCM can go straight into one PSRAM buffer
+    size_t packets = 0;
+    for (const char* p = sound.data(); p + sizeof(BinaryProtocol3) <= sound.data() + sound.size(); ) {
+        auto p3 = (const BinaryProtocol3*)p;
+        p += sizeof(BinaryProtocol3) + ntohs(p3->payload_size);
+        packets++;
+    }
+
+    AudioResampler resampler;
+    bool resample = sample_rate != SOUND_ASSET_SAMPLE_RATE;
+    if (resample) {
+        resampler.Configure(SOUND_ASSET_SAMPLE_RATE, sample_rate, kResamplerQualityHigh);
+    }
+    int frame_samples = SOUND_ASSET_SAMPLE_RATE * SOUND_ASSET_FRAME_DURATION_MS / 1000;
+    // One extra sample per frame covers the fractional phase carried over between frames
+    size_t frame_output_samples = resample ? resampler.GetOutputSamples(frame_samples) + 1 : frame_samples;
+    size_t max_samples = packets * frame_output_samples;
+    if (max_samples == 0 || max_samples * sizeof(int16_t) > SOUND_CACHE_MAX_SOUND_BYTES) {
+        return nullptr;
+    }
+
+    auto cached = std::make_shared<CachedSound>();
+    cached->key = sound.data();
+    cached->sample_rate = sample_rate;
+    cached->pcm = (int16_t*)heap_caps_malloc(max_samples * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (cached->pcm == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %zu bytes for a sound", max_samples * sizeof(int16_t));
+        return nullptr;
+    }
+
+    OpusDecoderWrapper decoder(SOUND_ASSET_SAMPLE_RATE, 1, SOUND_ASSET_FRAME_DURATION_MS);
+    std::vector<int16_t> pcm;
+    for (const char* p = sound.data(); p + sizeof(BinaryProtocol3) <= sound.data() + sound.size(); ) {
+        auto p3 = (const BinaryProtocol3*)p;
+        auto payload_size = ntohs(p3->payload_size);
+        p += sizeof(BinaryProtocol3) + payload_size;
+
+        std::vector<uint8_t> opus(p3->payload, p3->payload + payload_size);
+        if (!decoder.Decode(std::move(opus), pcm) || pcm.size() > (size_t)frame_samples) {
+            continue;
+        }
+        int16_t* output = cached->pcm + cached->samples;
+        if (resample) {
+            size_t output_samples = resampler.GetOutputSamples(pcm.size());
+            resampler.Process(pcm.data(), pcm.size(), output);
+            cached->samples += output_samples;
+        } else {
+            std::copy(pcm.begin(), pcm.end(), output);
+            cached->samples += pcm.size();
+        }
+    }
+
+    ESP_LOGI(TAG, "Decoded sound of %zu packets into %zu samples in %lld ms", packets, cached->samples,
+        (esp_timer_get_time() - start_time) / 1000);
+    return cached;
+}
@@ -0,0 +1,50 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+// Total PSRAM spent on decoded sounds, and the largest single sound worth caching
+#define SOUND_CACHE_MAX_BYTES (512 * 1024)
+#define SOUND_CACHE_MAX_SOUND_BYTES (SOUND_CACHE_MAX_BYTES / 4)
+
+// Decoded PCM of a built-in P3 sound, already at the output sample rate
+struct CachedSound {
+    const char* key = nullptr;
+    int sample_rate = 0;
+    int16_t* pcm = nullptr;
+    size_t samples = 0;
+
+    ~CachedSound();
+};
+
+// LRU cache of decoded built-in sounds in PSRAM, keyed by the address of the embedded asset.
+// Without PSRAM nothing is cached and the callers fall back to decoding on the fly.
+class SoundCache {
+public:
+    SoundCache(size_t max_bytes = SOUND_CACHE_MAX_BYTES);
+
+    // Returns the cached PCM or nullptr, cheap enough for any task
+    std::shared_ptr<const CachedSound> Find(const std::string_view& sound, int sample_rate);
+    // Like Find, but decodes and caches the sound on a miss.
+    // Decoding needs the stack of an audio task. Returns nullptr if the sound cannot be cached.
+    std::shared_ptr<const CachedSound> Load(const std::string_view& sound, int sample_rate);
+    void Clear();
+
+    inline bool enabled() const { return enabled_; }
+
+private:
+    std::mutex mutex_;
+    std::list<std::shared_ptr<CachedSound>> sounds_;  // Most recently used first
+    size_t bytes_ = 0;
+    size_t max_bytes_;
+    bool enabled_ = false;
+
+    std::shared_ptr<CachedSound> Decode(const std::string_view& sound, int sample_rate);
+};
+
+#endif // SOUND_CACHE_H
@@ -0,0 +1,83 @@
+#include "tls_session_cache.h"
+
+#include <esp_log.h>
+
+#define TAG "TlsSessionCache"
+
+std::string TlsSessionCache::MakeKey(const std::string& host, int port) {
+    return host + ":" + std::to_string(port);
+}
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+std::shared_ptr<esp_tls_client_session_t> TlsSessionCache::Find(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.lookups++;
+    auto key = MakeKey(host, port);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key) {
+            entries_.splice(entries_.begin(), entries_, it);
+            stats_.hits++;
+            // Copied under the lock, a concurrent Store or Remove only drops the cache's reference
+            return entries_.front().session;
+        }
+    }
+    return nullptr;
+}
+
+void TlsSessionCache::Store(const std::string& host, int port, esp_tls_client_session_t* session) {
+    if (session == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.stores++;
+    auto key = MakeKey(host, port);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key) {
+            entries_.erase(it);
+            break;
+        }
+    }
+    while (entries_.size() >= TLS_SESSION_CACHE_MAX_ENTRIES) {
+        entries_.pop_back();
+    }
+    entries_.push_front({key, std::shared_ptr<esp_tls_client_session_t>(session, esp_tls_free_client_session)});
+}
+#endif
+
+void TlsSessionCache::Remove(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto key = MakeKey(host, port);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key) {
+            entries_.erase(it);
+            return;
+        }
+    }
+}
+
+void TlsSessionCache::RecordHandshake(bool offered, uint32_t duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (offered) {
+        stats_.offered_handshakes++;
+        stats_.offered_handshake_ms += duration_ms;
+    } else {
+        stats_.full_handshakes++;
+        stats_.full_handshake_ms += duration_ms;
+    }
+}
+
+TlsSessionCacheStats TlsSessionCache::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void TlsSessionCache::PrintStats() {
+    auto stats = GetStats();
+    if (stats.lookups == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "TLS sessions: lookups %lu hits %lu (%lu%%) stores %lu, handshake avg session offered %lu ms full %lu ms",
+        stats.lookups, stats.hits, stats.hits * 100 / stats.lookups, stats.stores,
+        stats.offered_handshakes > 0 ? stats.offered_handshake_ms / stats.offered_handshakes : 0,
+        stats.full_handshakes > 0 ? stats.full_handshake_ms / stats.full_handshakes : 0);
+}
@@ -0,0 +1,71 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <esp_tls.h>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Only the WebSocket transport resumes sessions. One entry for its server, one more so that
+// a server change from the OTA config does not evict the session of the one before.
+#define TLS_SESSION_CACHE_MAX_ENTRIES 2
+
+struct TlsSessionCacheStats {
+    uint32_t lookups = 0;
+    uint32_t hits = 0;
+    uint32_t stores = 0;
+    // Handshake time summed over connects that did and did not offer a cached session. Whether
+    // the server accepted an offered session is not visible through esp-tls, a server that
+    // declines falls back to a full handshake and still counts as offered.
+    uint32_t offered_handshakes = 0;
+    uint32_t offered_handshake_ms = 0;
+    uint32_t full_handshakes = 0;
+    uint32_t full_handshake_ms = 0;
+};
+
+// RAM cache of TLS client sessions keyed by host and port, used by ResumableTlsTransport,
+// i.e. the WebSocket protocol. OTA and MQTT connect through the board's own transports,
+// which do not take a session. Offering a cached session lets the server skip the certificate
+// exchange and key agreement, which is the bulk of a handshake on a slow link.
+// Sessions only live until reboot.
+class TlsSessionCache {
+public:
+    static TlsSessionCache& GetInstance() {
+        static TlsSessionCache instance;
+        return instance;
+    }
+    TlsSessionCache(const TlsSessionCache&) = delete;
+    TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // Returns the session to offer for host:port, or nullptr. The session is shared with the
+    // cache, it stays valid for as long as the caller holds it even if the entry is replaced.
+    std::shared_ptr<esp_tls_client_session_t> Find(const std::string& host, int port);
+    // Takes the ownership of `session`, replacing what was cached for host:port
+    void Store(const std::string& host, int port, esp_tls_client_session_t* session);
+#endif
+    void Remove(const std::string& host, int port);
+    void RecordHandshake(bool offered, uint32_t duration_ms);
+    TlsSessionCacheStats GetStats();
+    void PrintStats();
+
+private:
+    TlsSessionCache() = default;
+    ~TlsSessionCache() = default;
+
+    struct Entry {
+        std::string key;
+        std::shared_ptr<esp_tls_client_session_t> session;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> entries_;  // Most recently used first
+    TlsSessionCacheStats stats_;
+
+    static std::string MakeKey(const std::string& host, int port);
+};
+
+#endif // TLS_SESSION_CACHE_H
@@ -0,0 +1,72 @@
+#include "uplink_encoder.h"
+
+#include <esp_log.h>
+
+#define TAG "UplinkEncoder"
+
+// Opus allows at most 1275 bytes per frame
+#define UPLINK_MAX_PACKET_SIZE 1276
+
+UplinkEncoder::UplinkEncoder(int sample_rate, int channels, int duration_ms)
+    : frame_size_(sample_rate / 1000 * duration_ms), frame_samples_(frame_size_ * channels) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    SetDtx(false);
+    in_buffer_.reserve(frame_samples_ * 2);
+}
+
+UplinkEncoder::~UplinkEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void UplinkEncoder::SetComplexity(int complexity) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void UplinkEncoder::SetDtx(bool enable) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+    }
+}
+
+void UplinkEncoder::SetBitrate(int bitrate) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+    }
+}
+
+void UplinkEncoder::ResetState() {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
+
+void UplinkEncoder::Encode(std::vector<int16_t>&& pcm, std::function<void(std::vector<uint8_t>&& opus)> handler) {
+    if (encoder_ == nullptr) {
+        return;
+    }
+    in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+
+    size_t offset = 0;
+    while (in_buffer_.size() - offset >= frame_samples_) {
+        std::vector<uint8_t> opus(UPLINK_MAX_PACKET_SIZE);
+        int ret = opus_encode(encoder_, in_buffer_.data() + offset, frame_size_, opus.data(), opus.size());
+        offset += frame_samples_;
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+            continue;
+        }
+        opus.resize(ret);
+        handler(std::move(opus));
+    }
+    in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + offset);
+}
@@ -0,0 +1,35 @@
+#ifndef UPLINK_ENCODER_H
+#define UPLINK_ENCODER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <opus.h>
+
+// Opus encoder for the uplink, like OpusEncoderWrapper but with bitrate control.
+// PCM may be fed in any chunk size, a packet is handed out for every complete frame.
+// Not thread safe, once handed to AudioUplink only its encoder task touches it.
+class UplinkEncoder {
+public:
+    UplinkEncoder(int sample_rate, int channels, int duration_ms);
+    ~UplinkEncoder();
+    UplinkEncoder(const UplinkEncoder&) = delete;
+    UplinkEncoder& operator=(const UplinkEncoder&) = delete;
+
+    void SetComplexity(int complexity);
+    void SetDtx(bool enable);
+    // Target in bits per second
+    void SetBitrate(int bitrate);
+    // Drops the buffered PCM and the prediction state, e.g. when a new turn starts
+    void ResetState();
+    void Encode(std::vector<int16_t>&& pcm, std::function<void(std::vector<uint8_t>&& opus)> handler);
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    size_t frame_size_;     // Samples per channel
+    size_t frame_samples_;  // Interleaved samples
+    std::vector<int16_t> in_buffer_;
+};
+
+#endif // UPLINK_ENCODER_H
@@ -0,0 +1,122 @@
+#include "host_test.h"
+#include "audio_capture.h"
+
+#include <cmath>
+
+// Microphone on the left channel, a different tone as the AEC reference on the right
+class FakeCodec : public AudioCodec {
+public:
+    FakeCodec(int sample_rate, int channels, int mic_level, int reference_level) : mic_level_(mic_level), reference_level_(reference_level) {
+        input_sample_rate_ = sample_rate;
+        input_channels_ = channels;
+    }
+
+    int frames_read() const { return frames_read_; }
+
+protected:
+    int Read(int16_t* dest, int samples) override {
+        for (int i = 0; i < samples; i += input_channels_) {
+            dest[i] = mic_level_;
+            if (input_channels_ == 2) {
+                dest[i + 1] = reference_level_;
+            }
+        }
+        frames_read_ += samples / input_channels_;
+        return samples;
+    }
+
+private:
+    int16_t mic_level_;
+    int16_t reference_level_;
+    int frames_read_ = 0;
+};
+
+static void TestPassThrough() {
+    FakeCodec codec(16000, 1, 1234, 0);
+    AudioCapture capture;
+    capture.Configure(&codec, 16000);
+    std::vector<int16_t> data;
+    CHECK(capture.Read(data, 480));
+    CHECK_EQ(data.size(), 480);
+    CHECK_EQ(data[0], 1234);
+    CHECK_EQ(data[479], 1234);
+}
+
+// The kernels have unity DC gain, so once the filters are full a constant comes out exactly
+static void TestStereoResampled(int input_rate) {
+    FakeCodec codec(input_rate, 2, 1000, -3000);
+    AudioCapture capture;
+    capture.Configure(&codec, 16000);
+    std::vector<int16_t> data;
+    for (int frame = 0; frame < 4; frame++) {
+        CHECK(capture.Read(data, 2 * 480));
+    }
+    // 30ms at 16kHz per channel, interleaved mic and reference
+    CHECK_EQ(data.size(), 2 * 480);
+    CHECK_EQ(codec.frames_read(), 4 * 480 * input_rate / 16000);
+    CHECK_EQ(data[0], 1000);
+    CHECK_EQ(data[1], -3000);
+    CHECK_EQ(data[2 * 479], 1000);
+    CHECK_EQ(data[2 * 479 + 1], -3000);
+}
+
+static void TestMonoResampled() {
+    FakeCodec codec(24000, 1, -700, 0);
+    AudioCapture capture;
+    capture.Configure(&codec, 16000);
+    std::vector<int16_t> data;
+    CHECK(capture.Read(data, 320));
+    CHECK(capture.Read(data, 320));
+    CHECK_EQ(data.size(), 320);
+    CHECK_EQ(data[319], -700);
+}
+
+// After the first frame the scratch buffers have their size, later frames must not allocate
+static void TestNoHeapAfterFirstFrame(int input_rate, int channels) {
+    FakeCodec codec(input_rate, channels, 100, 200);
+    AudioCapture capture;
+    capture.Configure(&codec, 16000);
+    std::vector<int16_t> data;
+    int samples = channels * 480;
+    size_t before = HeapAllocations();
+    capture.Read(data, samples);
+    // The count works, the first frame sizes the buffers
+    CHECK(HeapAllocations() > before);
+
+    before = HeapAllocations();
+    for (int i = 0; i < 200; i++) {
+        capture.Read(data, samples);
+    }
+    if (!CHECK_EQ(HeapAllocations() - before, 0)) {
+        fprintf(stderr, "  with %d channels at %d Hz\n", channels, input_rate);
+    }
+
+    // Shorter frames fit the same buffers
+    before = HeapAllocations();
+    capture.Read(data, channels * 160);
+    CHECK_EQ(HeapAllocations() - before, 0);
+}
+
+static void BenchmarkCapture() {
+    FakeCodec codec(24000, 2, 100, 200);
+    AudioCapture capture;
+    capture.Configure(&codec, 16000);
+    std::vector<int16_t> data;
+    Benchmark("AudioCapture 30ms stereo 24k->16k", 20000, [&]() {
+        capture.Read(data, 2 * 480);
+        DoNotOptimize(data[0]);
+    });
+}
+
+int main() {
+    TestPassThrough();
+    TestStereoResampled(24000);
+    TestStereoResampled(48000);
+    TestMonoResampled();
+    TestNoHeapAfterFirstFrame(16000, 1);
+    TestNoHeapAfterFirstFrame(24000, 1);
+    TestNoHeapAfterFirstFrame(24000, 2);
+    TestNoHeapAfterFirstFrame(48000, 2);
+    BenchmarkCapture();
+    return TestResult();
+}
@@ -0,0 +1,176 @@
+#include "host_test.h"
+#include "audio_mixer.h"
+
+#include <vector>
+
+static std::vector<int16_t> Constant(size_t samples, int16_t value) {
+    return std::vector<int16_t>(samples, value);
+}
+
+// One stream at unity gain comes out unchanged
+static void TestUnityPassThrough() {
+    AudioMixer mixer;
+    std::vector<int16_t> speech(480);
+    for (size_t i = 0; i < speech.size(); i++) {
+        speech[i] = int16_t(i * 139 - 32768);
+    }
+    mixer.Begin(speech.size());
+    mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+    CHECK(mixer.Mix() == speech);
+}
+
+// Two loud streams saturate instead of wrapping around
+static void TestClipping() {
+    AudioMixer mixer;
+    auto high = Constant(240, 30000);
+    auto low = Constant(240, -30000);
+    // Ducking would lower the speech, keep it at unity to add both at full scale
+    mixer.SetDuckingGain(AUDIO_MIXER_UNITY_GAIN);
+
+    mixer.Begin(240);
+    mixer.Add(kAudioMixerStreamSpeech, high.data(), high.size());
+    mixer.Add(kAudioMixerStreamNotification, high.data(), high.size());
+    auto& positive = mixer.Mix();
+    CHECK_EQ(positive.front(), INT16_MAX);
+    CHECK_EQ(positive.back(), INT16_MAX);
+
+    mixer.Begin(240);
+    mixer.Add(kAudioMixerStreamSpeech, low.data(), low.size());
+    mixer.Add(kAudioMixerStreamNotification, low.data(), low.size());
+    auto& negative = mixer.Mix();
+    CHECK_EQ(negative.front(), INT16_MIN);
+    CHECK_EQ(negative.back(), INT16_MIN);
+
+    // Opposite streams cancel out without clipping on the way
+    mixer.Begin(240);
+    mixer.Add(kAudioMixerStreamSpeech, high.data(), high.size());
+    mixer.Add(kAudioMixerStreamNotification, low.data(), low.size());
+    auto& cancelled = mixer.Mix();
+    CHECK_EQ(cancelled.front(), 0);
+    CHECK_EQ(cancelled.back(), 0);
+}
+
+// Speech ducks while a notification plays and comes back after, ramping over a block both ways
+static void TestDucking() {
+    AudioMixer mixer;
+    auto speech = Constant(480, 16000);
+    auto silence = Constant(480, 0);
+
+    mixer.Begin(480);
+    mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+    CHECK_EQ(mixer.Mix().back(), 16000);
+
+    // The first block with a notification ramps down, without a step between two samples
+    mixer.Begin(480);
+    mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+    mixer.Add(kAudioMixerStreamNotification, silence.data(), silence.size());
+    auto& ramp = mixer.Mix();
+    CHECK(ramp.front() > 15900);
+    int largest_step = 0;
+    bool monotonic = true;
+    for (size_t i = 1; i < ramp.size(); i++) {
+        largest_step = std::max(largest_step, ramp[i - 1] - ramp[i]);
+        monotonic = monotonic && ramp[i] <= ramp[i - 1];
+    }
+    CHECK(monotonic);
+    CHECK(largest_step <= 2 * 12000 / 480);
+    CHECK(ramp.back() <= 16000 * AUDIO_MIXER_DUCKING_GAIN / AUDIO_MIXER_UNITY_GAIN + 30);
+
+    // Fully ducked, -12dB is exactly a quarter
+    mixer.Begin(480);
+    mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+    mixer.Add(kAudioMixerStreamNotification, silence.data(), silence.size());
+    CHECK_EQ(mixer.Mix().front(), 4000);
+
+    // And back up once the notification is over
+    mixer.Begin(480);
+    mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+    auto& recovery = mixer.Mix();
+    CHECK(recovery.front() < 4100);
+    CHECK(recovery.back() > 15900);
+    mixer.Begin(480);
+    mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+    CHECK_EQ(mixer.Mix().front(), 16000);
+}
+
+static void TestGainsAndShortStreams() {
+    AudioMixer mixer;
+    auto speech = Constant(480, 10000);
+    auto chime = Constant(100, 2000);
+
+    // Out of range gains are clamped to unity
+    mixer.SetGain(kAudioMixerStreamNotification, 3 * AUDIO_MIXER_UNITY_GAIN);
+    mixer.SetGain(kAudioMixerStreamSpeech, -5);
+    auto mix_block = [&]() -> std::vector<int16_t>& {
+        mixer.Begin(480);
+        mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+        mixer.Add(kAudioMixerStreamNotification, chime.data(), chime.size());
+        return mixer.Mix();
+    };
+    // Gain changes ramp over the first block, check the one after
+    mix_block();
+    auto& mixed = mix_block();
+    CHECK_EQ(mixed.size(), 480);
+    // Speech is muted, the chime ends early and the rest of the block is silent
+    CHECK_EQ(mixed[0], 2000);
+    CHECK_EQ(mixed[99], 2000);
+    CHECK_EQ(mixed[100], 0);
+    CHECK_EQ(mixed[479], 0);
+
+    // Nothing added, the block is silence of the requested length
+    mixer.Begin(160);
+    auto& empty = mixer.Mix();
+    CHECK_EQ(empty.size(), 160);
+    CHECK_EQ(empty[0], 0);
+}
+
+static void TestNoHeapAfterFirstBlock() {
+    AudioMixer mixer;
+    auto speech = Constant(1440, 1000);
+    auto chime = Constant(1440, 500);
+    mixer.Begin(1440);
+    mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+    mixer.Mix();
+
+    size_t before = HeapAllocations();
+    for (int i = 0; i < 100; i++) {
+        mixer.Begin(480 + i * 9);
+        mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+        mixer.Add(kAudioMixerStreamNotification, chime.data(), i * 11);
+        mixer.Mix();
+    }
+    CHECK_EQ(HeapAllocations() - before, 0);
+}
+
+// CPU for one 60ms block at 24kHz, the largest the output job mixes
+static void BenchmarkMix() {
+    AudioMixer mixer;
+    std::vector<int16_t> speech(1440);
+    std::vector<int16_t> chime(1440);
+    for (size_t i = 0; i < speech.size(); i++) {
+        speech[i] = int16_t(i * 37);
+        chime[i] = int16_t(i * 91);
+    }
+    double one = Benchmark("mix 60ms at 24kHz, speech only", 20000, [&]() {
+        mixer.Begin(speech.size());
+        mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+        DoNotOptimize(mixer.Mix()[0]);
+    });
+    double two = Benchmark("mix 60ms at 24kHz, speech and chime", 20000, [&]() {
+        mixer.Begin(speech.size());
+        mixer.Add(kAudioMixerStreamSpeech, speech.data(), speech.size());
+        mixer.Add(kAudioMixerStreamNotification, chime.data(), chime.size());
+        DoNotOptimize(mixer.Mix()[0]);
+    });
+    printf("mixing takes %.4f%% and %.4f%% of real time here\n", one / 60e6 * 100, two / 60e6 * 100);
+}
+
+int main() {
+    TestUnityPassThrough();
+    TestClipping();
+    TestDucking();
+    TestGainsAndShortStreams();
+    TestNoHeapAfterFirstBlock();
+    BenchmarkMix();
+    return TestResult();
+}
@@ -0,0 +1,605 @@
+#include "host_test.h"
+#include "json_view.h"
+#include "control_message.h"
+
+#include <cJSON.h>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937_64 random_engine(1234);
+
+static int Random(int n) {
+    return random_engine() % n;
+}
+
+static bool Parse(const std::string& text, JsonView& root) {
+    return JsonView::Parse(text.data(), text.size(), root);
+}
+
+// Server messages as the application dispatches them
+static void TestServerMessages() {
+    std::string text = R"({"type":"tts","state":"sentence_start","text":"你好\n\"世界\"","session_id":"a1"})";
+    JsonView root;
+    CHECK(Parse(text, root));
+    CHECK(root.IsObject());
+    CHECK(root.Get("type").Equals("tts"));
+    CHECK(!root.Get("type").Equals("tt"));
+    CHECK(root.Get("state").Equals("sentence_start"));
+    CHECK(root.Get("text").ToString() == "你好\n\"世界\"");
+
+    // Missing members and wrong types read as the fallback, lookups chain safely
+    CHECK(!root.Get("emotion"));
+    CHECK(root.Get("emotion").ToString().empty());
+    CHECK_EQ(root.Get("type").ToInt(-1), -1);
+    CHECK(!root.Get("missing").Get("deeper").At(3));
+
+    text = R"({"type":"hello","transport":"websocket","audio_params":{"sample_rate":24000,"frame_duration":60},
+              "features":[true,false,null,-1.5e3]})";
+    CHECK(Parse(text, root));
+    auto params = root.Get("audio_params");
+    CHECK_EQ(params.Get("sample_rate").ToInt(), 24000);
+    CHECK_EQ(params.Get("frame_duration").ToInt(), 60);
+    auto features = root.Get("features");
+    CHECK_EQ(features.Size(), 4);
+    CHECK(features.At(0).ToBool());
+    CHECK(!features.At(1).ToBool(true));
+    CHECK_EQ(features.At(2).type(), kJsonNull);
+    CHECK(features.At(3).ToNumber() == -1500);
+    CHECK(!features.At(4));
+
+    // \u escapes, surrogate pairs included, decode to UTF-8. A lone surrogate reads as U+FFFD.
+    text = R"({"text":"\u4f60\ud83d\ude00\u0041","lone":"\ud83d!"})";
+    CHECK(Parse(text, root));
+    CHECK(root.Get("text").ToString() == "你😀A");
+    CHECK(root.Get("text").Equals("你😀A"));
+    CHECK(root.Get("lone").ToString() == "\xef\xbf\xbd!");
+
+    // Keys are compared decoded
+    text = R"({"ty\u0070e":"stt"})";
+    CHECK(Parse(text, root));
+    CHECK(root.Get("type").Equals("stt"));
+}
+
+static void TestMalformed() {
+    const char* const kInvalid[] = {
+        "", " ", "{", "}", "{\"a\"}", "{\"a\":}", "{\"a\":1,}", "[1,]", "[1 2]", "{a:1}", "\"abc", "\"a\\x\"",
+        "\"\\u12\"", "01", "-", "1.", ".5", "1e", "+1", "tru", "nul", "{\"a\":1}}", "[1]x", "{\"a\":1} {}",
+        "\"a\nb\"",
+    };
+    for (auto text : kInvalid) {
+        JsonView root;
+        if (!CHECK(!JsonView::Parse(text, strlen(text), root))) {
+            fprintf(stderr, "  accepted %s\n", text);
+        }
+    }
+
+    // A terminating NUL and surrounding whitespace are fine
+    const char text[] = " {\"a\":[1,2]}\n";
+    JsonView root;
+    CHECK(JsonView::Parse(text, sizeof(text), root));
+    CHECK_EQ(root.Get("a").Size(), 2);
+}
+
+// The same depth limit applies to JSON text, binary messages and the writer
+static void TestDepthLimit() {
+    auto nested = [](int depth) {
+        return std::string(depth, '[') + std::string(depth, ']');
+    };
+    // The innermost array of n is at depth n - 1
+    JsonView root;
+    CHECK(Parse(nested(CONTROL_MESSAGE_MAX_DEPTH + 1), root));
+    CHECK(!Parse(nested(CONTROL_MESSAGE_MAX_DEPTH + 2), root));
+    CHECK(!Parse(nested(100000), root));
+
+    // {"a": [[...[1]...]]}, with the 1 at the deepest level allowed
+    std::vector<uint8_t> cbor = {0xa1, 0x61, 'a'};
+    cbor.insert(cbor.end(), CONTROL_MESSAGE_MAX_DEPTH - 1, 0x81);
+    cbor.push_back(0x01);
+    CHECK(JsonView::ParseCbor(cbor.data(), cbor.size(), root));
+    cbor.insert(cbor.begin() + 3, 0x81);
+    CHECK(!JsonView::ParseCbor(cbor.data(), cbor.size(), root));
+}
+
+// Random JSON text, compared member by member with the tree cJSON builds from it
+
+static const char* const kStrings[] = {
+    "type", "tts", "hello", "state", "text", "a\\\"b", "c\\\\d", "x\\ny", "\\t\\r\\b\\f\\/", "\\u4f60\\u597d",
+    "\\ud83d\\ude00", "中文", "", "sentence_start", "session_id", "commands", "value",
+};
+
+static std::string RandomString() {
+    return std::string("\"") + kStrings[Random(sizeof(kStrings) / sizeof(kStrings[0]))] + "\"";
+}
+
+static std::string RandomNumber() {
+    static const char* const kNumbers[] = {"0", "-0", "1", "-1", "24000", "1.5", "-2.25e-3", "1E10", "123456789012",
+                                           "0.1", "-9007199254740993", "3.4028234663852886e38", "5e-324"};
+    return kNumbers[Random(sizeof(kNumbers) / sizeof(kNumbers[0]))];
+}
+
+static std::string RandomJson(int depth) {
+    static const char* const kSpace[] = {"", "", "", " ", "\n\t "};
+    auto space = [] { return std::string(kSpace[Random(5)]); };
+    int kind = Random(depth > 6 ? 5 : 7);
+    switch (kind) {
+        case 0: return RandomNumber();
+        case 1: return RandomString();
+        case 2: return Random(2) ? "true" : "false";
+        case 3: return "null";
+        case 4: return RandomNumber();
+        case 5: {
+            std::string text = "[" + space();
+            int count = Random(5);
+            for (int i = 0; i < count; i++) {
+                text += (i > 0 ? "," + space() : "") + RandomJson(depth + 1) + space();
+            }
+            return text + "]";
+        }
+        default: {
+            std::string text = "{" + space();
+            int count = Random(6);
+            for (int i = 0; i < count; i++) {
+                text += (i > 0 ? "," + space() : "") + RandomString() + space() + ":" + space() + RandomJson(depth + 1) + space();
+            }
+            return text + "}";
+        }
+    }
+}
+
+static int CjsonType(const cJSON* item) {
+    switch (item->type & 0xff) {
+        case cJSON_NULL: return kJsonNull;
+        case cJSON_False: return kJsonFalse;
+        case cJSON_True: return kJsonTrue;
+        case cJSON_Number: return kJsonNumber;
+        case cJSON_String: return kJsonString;
+        case cJSON_Array: return kJsonArray;
+        case cJSON_Object: return kJsonObject;
+        default: return kJsonNone;
+    }
+}
+
+static bool SameAsCjson(const JsonView& view, const cJSON* item) {
+    if (view.type() != CjsonType(item)) {
+        return false;
+    }
+    switch (view.type()) {
+        case kJsonNumber:
+            return view.ToNumber() == item->valuedouble;
+        case kJsonString:
+            return view.ToString() == item->valuestring && view.Equals(item->valuestring);
+        case kJsonArray:
+        case kJsonObject: {
+            if (view.Size() != size_t(cJSON_GetArraySize(item))) {
+                return false;
+            }
+            bool same = true;
+            const cJSON* child = item->child;
+            size_t index = 0;
+            view.ForEach([&](const JsonView& key, const JsonView& value) {
+                if (view.IsObject()) {
+                    // Get() and cJSON both find the first of repeated keys
+                    same = same && key.ToString() == child->string &&
+                           SameAsCjson(view.Get(child->string), cJSON_GetObjectItemCaseSensitive(item, child->string));
+                } else {
+                    same = same && SameAsCjson(view.At(index), child);
+                }
+                same = same && SameAsCjson(value, child);
+                child = child->next;
+                index++;
+                return same;
+            });
+            return same;
+        }
+        default:
+            return true;
+    }
+}
+
+static void TestJsonTextAgainstCjson() {
+    int mismatches = 0;
+    int accepted_mutations = 0;
+    for (int i = 0; i < 20000; i++) {
+        std::string text = RandomJson(0);
+        JsonView root;
+        cJSON* tree = cJSON_ParseWithLength(text.data(), text.size());
+        if (!CHECK(Parse(text, root) && tree != nullptr)) {
+            fprintf(stderr, "  rejected %s\n", text.c_str());
+        } else if (!SameAsCjson(root, tree) && mismatches++ < 5) {
+            fprintf(stderr, "JsonView reads differently from cJSON: %s\n", text.c_str());
+        }
+        cJSON_Delete(tree);
+
+        // Damaged text that both still accept must read the same. JsonView alone accepts lone
+        // surrogates, and cJSON alone trailing text and leading zeros, so they may disagree on validity.
+        std::string mutated = text;
+        switch (Random(3)) {
+            case 0: mutated[Random(mutated.size())] ^= 1 << Random(8); break;
+            case 1: mutated.resize(Random(mutated.size())); break;
+            default: mutated.insert(Random(mutated.size() + 1), 1, "{}[],:\"\\0-e"[Random(11)]); break;
+        }
+        tree = cJSON_ParseWithLength(mutated.data(), mutated.size());
+        if (Parse(mutated, root) && tree != nullptr) {
+            accepted_mutations++;
+            if (!SameAsCjson(root, tree) && mismatches++ < 5) {
+                fprintf(stderr, "JsonView reads differently from cJSON: %s\n", mutated.c_str());
+            }
+        }
+        cJSON_Delete(tree);
+    }
+    CHECK_EQ(mismatches, 0);
+    printf("JSON text: 20000 documents and %d valid mutations matched cJSON\n", accepted_mutations);
+}
+
+// Random binary control messages, read in place and after conversion to JSON text
+
+static const char* const kTexts[] = {"type", "tts", "hello", "start", "a\"b", "c\\d", "x\ny", "\x01\x1f", "中文", "",
+                                     "state", "text", "commands", "name", "value", "sentence_start", "stop"};
+
+static void WriteHead(std::vector<uint8_t>& out, int major, uint64_t value) {
+    // Any valid length encoding, not only the shortest
+    int form = Random(4);
+    major <<= 5;
+    if (value < 24 && form == 0) {
+        out.push_back(major | value);
+    } else if (value <= 0xff && form <= 1) {
+        out.push_back(major | 24);
+        out.push_back(value);
+    } else if (value <= 0xffff && form <= 2) {
+        out.push_back(major | 25);
+        out.push_back(value >> 8);
+        out.push_back(value);
+    } else if (value <= 0xffffffffull && Random(2)) {
+        out.push_back(major | 26);
+        for (int i = 3; i >= 0; i--) {
+            out.push_back(value >> (8 * i));
+        }
+    } else {
+        out.push_back(major | 27);
+        for (int i = 7; i >= 0; i--) {
+            out.push_back(value >> (8 * i));
+        }
+    }
+}
+
+static void WriteText(std::vector<uint8_t>& out, const std::string& text) {
+    if (Random(4) != 0) {
+        WriteHead(out, 3, text.size());
+        out.insert(out.end(), text.begin(), text.end());
+        return;
+    }
+    // Indefinite length, in chunks
+    out.push_back(0x7f);
+    size_t position = 0;
+    while (position < text.size()) {
+        size_t length = Random(text.size() - position + 1);
+        WriteHead(out, 3, length);
+        out.insert(out.end(), text.begin() + position, text.begin() + position + length);
+        position += length;
+    }
+    out.push_back(0xff);
+}
+
+static std::string RandomText() {
+    if (Random(2)) {
+        return kTexts[Random(sizeof(kTexts) / sizeof(kTexts[0]))];
+    }
+    std::string text;
+    for (int i = Random(8); i > 0; i--) {
+        text += char(Random(256));
+    }
+    return text;
+}
+
+static void WriteItem(std::vector<uint8_t>& out, int depth, bool envelope_type);
+
+static void WriteMap(std::vector<uint8_t>& out, int depth) {
+    int count = Random(depth > 6 ? 2 : 6);
+    bool indefinite = Random(3) == 0;
+    if (indefinite) {
+        out.push_back(0xbf);
+    } else {
+        WriteHead(out, 5, count);
+    }
+    for (int i = 0; i < count; i++) {
+        bool type_key;
+        if (Random(2)) {
+            int key = Random(kControlKeyCount);
+            WriteHead(out, 0, key);
+            type_key = key == kControlKeyType;
+        } else {
+            std::string key = RandomText();
+            WriteText(out, key);
+            type_key = key == "type";
+        }
+        WriteItem(out, depth + 1, depth == 0 && type_key);
+    }
+    if (indefinite) {
+        out.push_back(0xff);
+    }
+}
+
+static void WriteItem(std::vector<uint8_t>& out, int depth, bool envelope_type) {
+    if (envelope_type && Random(2)) {
+        WriteHead(out, 0, Random(kControlTypeCount + 3));
+        return;
+    }
+    switch (Random(depth > 8 ? 7 : 9)) {
+        case 0: WriteHead(out, 0, Random(3) ? Random(1000) : random_engine()); break;
+        case 1: WriteHead(out, 1, Random(3) ? Random(1000) : random_engine()); break;
+        case 2: WriteText(out, RandomText()); break;
+        case 3: out.push_back(0xf4 + Random(4)); break;
+        case 4: {
+            uint16_t half = Random(4) ? random_engine() : (Random(2) ? 0x7c00 : 0x7e00);
+            out.insert(out.end(), {0xf9, uint8_t(half >> 8), uint8_t(half)});
+            break;
+        }
+        case 5: {
+            float value = Random(4) ? float(Random(100000)) / (Random(1000) + 1) * (Random(2) ? 1 : -1) : (Random(2) ? INFINITY : NAN);
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            out.push_back(0xfa);
+            for (int i = 3; i >= 0; i--) {
+                out.push_back(bits >> (8 * i));
+            }
+            break;
+        }
+        case 6: {
+            double value = Random(4) ? double(int64_t(random_engine())) / double(random_engine() | 1) : NAN;
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            out.push_back(0xfb);
+            for (int i = 7; i >= 0; i--) {
+                out.push_back(bits >> (8 * i));
+            }
+            break;
+        }
+        case 7: {
+            int count = Random(5);
+            bool indefinite = Random(3) == 0;
+            if (indefinite) {
+                out.push_back(0x9f);
+            } else {
+                WriteHead(out, 4, count);
+            }
+            for (int i = 0; i < count; i++) {
+                WriteItem(out, depth + 1, false);
+            }
+            if (indefinite) {
+                out.push_back(0xff);
+            }
+            break;
+        }
+        default:
+            WriteMap(out, depth);
+            break;
+    }
+}
+
+// Two views of the same message, one in place and one of its JSON text, must read the same
+static bool SameViews(const JsonView& a, const JsonView& b) {
+    if (a.type() != b.type() || a.Size() != b.Size()) {
+        return false;
+    }
+    switch (a.type()) {
+        case kJsonString:
+            // Equals() never matches a string holding a NUL, on either side
+            return a.ToString() == b.ToString() && a.Equals(a.ToString().c_str()) == b.Equals(a.ToString().c_str());
+        case kJsonNumber: {
+            // Floats are printed with the digits their precision holds
+            double x = a.ToNumber(), y = b.ToNumber();
+            return x == y || std::fabs(x - y) <= 1e-4 * std::fabs(x);
+        }
+        case kJsonArray:
+        case kJsonObject: {
+            bool same = true;
+            size_t index = 0;
+            std::vector<std::pair<JsonView, JsonView>> members;
+            b.ForEach([&](const JsonView& key, const JsonView& value) {
+                members.emplace_back(key, value);
+                return true;
+            });
+            a.ForEach([&](const JsonView& key, const JsonView& value) {
+                same = same && index < members.size() && key.ToString() == members[index].first.ToString() &&
+                       SameViews(value, members[index].second);
+                if (a.IsObject()) {
+                    std::string name = key.ToString();
+                    same = same && SameViews(a.Get(name.c_str()), b.Get(name.c_str()));
+                } else {
+                    same = same && SameViews(a.At(index), b.At(index));
+                }
+                index++;
+                return same;
+            });
+            return same;
+        }
+        default:
+            return true;
+    }
+}
+
+static void TestCborAgainstJson() {
+    int valid = 0;
+    int mismatches = 0;
+    std::string json;
+    for (int i = 0; i < 50000; i++) {
+        std::vector<uint8_t> data;
+        if (Random(10) == 0) {
+            WriteItem(data, 0, false);
+        } else {
+            WriteMap(data, 0);
+        }
+        switch (Random(6)) {
+            case 0: data[Random(data.size())] ^= 1 << Random(8); break;
+            case 1: data.resize(Random(data.size())); break;
+            case 2: data.push_back(Random(256)); break;
+            default: break;
+        }
+
+        // Both readers must agree on what is a valid message, and then on its content
+        JsonView in_place;
+        bool in_place_valid = JsonView::ParseCbor(data.data(), data.size(), in_place);
+        JsonView converted;
+        bool converted_valid = ControlItemToJson(data.data(), data.size(), true, json) && Parse(json, converted);
+        if (in_place_valid != converted_valid || (in_place_valid && !SameViews(in_place, converted))) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "CBOR readers disagree on %s message of %zu bytes\n", in_place_valid ? "a valid" : "an invalid",
+                    data.size());
+            }
+            continue;
+        }
+        if (in_place_valid) {
+            valid++;
+            // ToCjson of both sides describes the same tree
+            cJSON* a = in_place.ToCjson();
+            cJSON* b = converted.ToCjson();
+            char* a_text = cJSON_PrintUnformatted(a);
+            char* b_text = cJSON_PrintUnformatted(b);
+            if (strcmp(a_text, b_text) != 0 && mismatches++ < 5) {
+                fprintf(stderr, "ToCjson differs:\n%s\n%s\n", a_text, b_text);
+            }
+            cJSON_free(a_text);
+            cJSON_free(b_text);
+            cJSON_Delete(a);
+            cJSON_Delete(b);
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+    CHECK(valid > 10000);
+    printf("CBOR: %d valid and %d invalid messages read the same both ways\n", valid, 50000 - valid);
+}
+
+static std::string Decode(ControlMessageWriter& message) {
+    std::string json;
+    if (!message.binary()) {
+        return message.text();
+    }
+    CHECK(ControlItemToJson(message.data().data(), message.data().size(), true, json));
+    return json;
+}
+
+// AddJson converts JSON text itself, it must give what converting cJSON's tree of it gives,
+// and a body spliced in with Append() must be byte for byte what adding its members gives
+static void TestWriter() {
+    int mismatches = 0;
+    for (int i = 0; i < 5000; i++) {
+        std::string value = RandomJson(1);
+        cJSON* tree = cJSON_ParseWithLength(value.data(), value.size());
+        for (bool binary : {false, true}) {
+            ControlMessageWriter from_text(binary);
+            from_text.Add("session_id", "s1").Add("type", "iot").AddJson("states", value);
+            ControlMessageWriter from_tree(binary);
+            from_tree.Add("session_id", "s1").Add("type", "iot").AddJson("states", tree);
+            JsonView a, b;
+            std::string a_json = Decode(from_text);
+            std::string b_json = Decode(from_tree);
+            if ((!Parse(a_json, a) || !Parse(b_json, b) || !SameViews(a, b)) && mismatches++ < 5) {
+                fprintf(stderr, "AddJson differs from the cJSON path:\n%s\n%s\n", a_json.c_str(), b_json.c_str());
+            }
+
+            ControlMessageWriter body(binary);
+            body.Add("type", "iot").Add("update", true).AddJson("descriptors", value);
+            ControlMessageWriter spliced(binary);
+            spliced.Add("session_id", "s1").Append(body);
+            ControlMessageWriter direct(binary);
+            direct.Add("session_id", "s1").Add("type", "iot").Add("update", true).AddJson("descriptors", value);
+            bool same = binary ? spliced.data() == direct.data() : spliced.text() == direct.text();
+            if (!same && mismatches++ < 5) {
+                fprintf(stderr, "Append differs from adding the members for %s\n", value.c_str());
+            }
+        }
+        cJSON_Delete(tree);
+    }
+    CHECK_EQ(mismatches, 0);
+
+    // An empty body adds nothing, a body of the other encoding is refused
+    ControlMessageWriter message(false);
+    message.Add("type", "listen").Append(ControlMessageWriter(false));
+    CHECK(message.text() == "{\"type\":\"listen\"}");
+    ControlMessageWriter other(true);
+    other.Add("state", "start");
+    ControlMessageWriter text(false);
+    text.Add("type", "listen").Append(other);
+    CHECK(text.text() == "{\"type\":\"listen\"}");
+
+    // The envelope type is an enum in binary, its name in JSON
+    ControlMessageWriter binary(true);
+    binary.Add("type", "listen").Add("state", "start").AddJson("states", "[{\"name\":\"Lamp\",\"state\":{\"power\":true}}]");
+    JsonView root;
+    CHECK(JsonView::ParseCbor(binary.data().data(), binary.data().size(), root));
+    CHECK(root.Get("type").Equals("listen"));
+    CHECK(root.Get("states").At(0).Get("state").Get("power").ToBool());
+    CHECK_EQ(binary.data()[1], kControlKeyType);
+    CHECK_EQ(binary.data()[2], kControlTypeListen);
+}
+
+static const char kTtsMessage[] =
+    R"({"type":"tts","state":"sentence_start","text":"今天天气不错，适合出去走走。","session_id":"8c6f4e2a-1b3d-4f5e-9a7c-2d1e0f3b4a5c"})";
+
+static void TestNoHeap() {
+    ControlMessageWriter writer(true);
+    writer.Add("type", "tts").Add("state", "sentence_start").Add("text", "今天天气不错").Add("session_id", "8c6f4e2a");
+    auto& cbor = writer.data();
+
+    size_t before = HeapAllocations();
+    for (int i = 0; i < 100; i++) {
+        JsonView root;
+        JsonView::Parse(kTtsMessage, sizeof(kTtsMessage) - 1, root);
+        DoNotOptimize(root.Get("type").Equals("tts") && root.Get("state").Equals("sentence_start"));
+        JsonView::ParseCbor(cbor.data(), cbor.size(), root);
+        DoNotOptimize(root.Get("type").Equals("tts") && root.Get("state").Equals("sentence_start"));
+    }
+    CHECK_EQ(HeapAllocations() - before, 0);
+}
+
+// What Application does with a TTS sentence, the most frequent message during a reply
+static void BenchmarkDispatch() {
+    std::string text;
+    double cjson = Benchmark("dispatch tts, cJSON", 200000, [&]() {
+        cJSON* root = cJSON_Parse(kTtsMessage);
+        auto type = cJSON_GetObjectItem(root, "type");
+        if (type != nullptr && strcmp(type->valuestring, "tts") == 0) {
+            auto state = cJSON_GetObjectItem(root, "state");
+            if (state != nullptr && strcmp(state->valuestring, "sentence_start") == 0) {
+                text = cJSON_GetObjectItem(root, "text")->valuestring;
+            }
+        }
+        cJSON_Delete(root);
+    });
+    double view = Benchmark("dispatch tts, JsonView", 200000, [&]() {
+        JsonView root;
+        if (JsonView::Parse(kTtsMessage, sizeof(kTtsMessage) - 1, root) && root.Get("type").Equals("tts") &&
+            root.Get("state").Equals("sentence_start")) {
+            text = root.Get("text").ToString();
+        }
+    });
+    printf("JsonView dispatches a tts message %.1fx as fast as cJSON\n", cjson / view);
+
+    ControlMessageWriter writer(true);
+    writer.Add("type", "tts").Add("state", "sentence_start").Add("text", "今天天气不错，适合出去走走。");
+    writer.Add("session_id", "8c6f4e2a-1b3d-4f5e-9a7c-2d1e0f3b4a5c");
+    auto& cbor = writer.data();
+    printf("the tts message is %zu bytes as JSON and %zu as CBOR\n", sizeof(kTtsMessage) - 1, cbor.size());
+    Benchmark("dispatch tts, JsonView on CBOR", 200000, [&]() {
+        JsonView root;
+        if (JsonView::ParseCbor(cbor.data(), cbor.size(), root) && root.Get("type").Equals("tts") &&
+            root.Get("state").Equals("sentence_start")) {
+            text = root.Get("text").ToString();
+        }
+    });
+}
+
+int main() {
+    TestServerMessages();
+    TestMalformed();
+    TestDepthLimit();
+    TestJsonTextAgainstCjson();
+    TestCborAgainstJson();
+    TestWriter();
+    TestNoHeap();
+    BenchmarkDispatch();
+    return TestResult();
+}
@@ -0,0 +1,171 @@
+#include "host_test.h"
+
+#include <arpa/inet.h>
+#include <mbedtls/aes.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// MqttProtocol::SendAudio builds UDP audio packets, the packet building of the version before
+// the reused buffer and of the current one are copied here since the class needs the MQTT and
+// UDP stack. Sizes are the ones in mqtt_protocol.h.
+#define MQTT_UDP_HEADER_SIZE 16
+#define MQTT_UDP_PACKET_CAPACITY 1024
+
+struct UdpChannel {
+    mbedtls_aes_context aes_ctx;
+    std::string aes_nonce;
+    uint32_t local_sequence = 0;
+    std::string send_packet;
+
+    UdpChannel() {
+        // Server hello values have this shape, type 0x01 followed by the session nonce
+        aes_nonce = std::string("\x01\x00\x00\x00\x12\x34\x56\x78\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+        const uint8_t key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+            0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+        mbedtls_aes_init(&aes_ctx);
+        mbedtls_aes_setkey_enc(&aes_ctx, key, 128);
+        send_packet.reserve(MQTT_UDP_PACKET_CAPACITY);
+    }
+    ~UdpChannel() {
+        mbedtls_aes_free(&aes_ctx);
+    }
+};
+
+// A nonce copy and a new packet string per packet, encrypting from the input
+static std::string BuildPacketCopying(UdpChannel& channel, const std::vector<uint8_t>& data) {
+    std::string nonce(channel.aes_nonce);
+    *(uint16_t*)&nonce[2] = htons(data.size());
+    *(uint32_t*)&nonce[12] = htonl(++channel.local_sequence);
+
+    std::string encrypted;
+    encrypted.resize(channel.aes_nonce.size() + data.size());
+    memcpy(encrypted.data(), nonce.data(), nonce.size());
+
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    if (mbedtls_aes_crypt_ctr(&channel.aes_ctx, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
+        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+        return std::string();
+    }
+    return encrypted;
+}
+
+// The reused buffer of SendAudio, encrypted in place with the counter on the stack
+static const std::string& BuildPacketInPlace(UdpChannel& channel, const std::vector<uint8_t>& data) {
+    channel.send_packet.resize(MQTT_UDP_HEADER_SIZE + data.size());
+    auto packet = (uint8_t*)channel.send_packet.data();
+    memcpy(packet, channel.aes_nonce.data(), MQTT_UDP_HEADER_SIZE);
+    *(uint16_t*)&packet[2] = htons(data.size());
+    *(uint32_t*)&packet[12] = htonl(++channel.local_sequence);
+    auto payload = packet + MQTT_UDP_HEADER_SIZE;
+    memcpy(payload, data.data(), data.size());
+
+    uint8_t counter[MQTT_UDP_HEADER_SIZE];
+    memcpy(counter, packet, MQTT_UDP_HEADER_SIZE);
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    if (mbedtls_aes_crypt_ctr(&channel.aes_ctx, data.size(), &nc_off, counter, stream_block, payload, payload) != 0) {
+        channel.send_packet.clear();
+    }
+    return channel.send_packet;
+}
+
+// What the receiving side of OnAudioChannel does with a packet
+static std::vector<uint8_t> Decrypt(UdpChannel& channel, const std::string& packet) {
+    uint8_t counter[MQTT_UDP_HEADER_SIZE];
+    memcpy(counter, packet.data(), MQTT_UDP_HEADER_SIZE);
+    std::vector<uint8_t> payload(packet.size() - MQTT_UDP_HEADER_SIZE);
+    size_t nc_off = 0;
+    uint8_t stream_block[16] = {0};
+    mbedtls_aes_crypt_ctr(&channel.aes_ctx, payload.size(), &nc_off, counter, stream_block,
+        (const uint8_t*)packet.data() + MQTT_UDP_HEADER_SIZE, payload.data());
+    return payload;
+}
+
+static std::vector<uint8_t> RandomFrame(std::mt19937& random, size_t size) {
+    std::vector<uint8_t> frame(size);
+    for (auto& byte : frame) {
+        byte = uint8_t(random());
+    }
+    return frame;
+}
+
+// Both versions put the same bytes on the wire, sizes cross the 16 byte CTR blocks
+static void TestSameBytes() {
+    UdpChannel copying;
+    UdpChannel in_place;
+    std::mt19937 random(1);
+    int mismatched = 0;
+    for (size_t size = 0; size <= MQTT_UDP_PACKET_CAPACITY - MQTT_UDP_HEADER_SIZE; size++) {
+        auto frame = RandomFrame(random, size);
+        if (BuildPacketCopying(copying, frame) != BuildPacketInPlace(in_place, frame)) {
+            mismatched++;
+        }
+    }
+    CHECK_EQ(mismatched, 0);
+}
+
+// The header goes out as built, and the payload decrypts with it as the counter
+static void TestHeaderAndRoundTrip() {
+    UdpChannel channel;
+    std::mt19937 random(2);
+    for (uint32_t sequence = 1; sequence <= 3; sequence++) {
+        auto frame = RandomFrame(random, 100 + sequence * 37);
+        std::string packet = BuildPacketInPlace(channel, frame);
+        CHECK_EQ(packet.size(), MQTT_UDP_HEADER_SIZE + frame.size());
+        CHECK_EQ((uint8_t)packet[0], 0x01);
+        CHECK_EQ(ntohs(*(uint16_t*)&packet[2]), frame.size());
+        CHECK(memcmp(&packet[4], &channel.aes_nonce[4], 8) == 0);
+        CHECK_EQ(ntohl(*(uint32_t*)&packet[12]), sequence);
+        CHECK(memcmp(packet.data() + MQTT_UDP_HEADER_SIZE, frame.data(), frame.size()) != 0);
+        CHECK(Decrypt(channel, packet) == frame);
+    }
+}
+
+// Building packets in the reserved buffer allocates nothing
+static void TestNoHeap() {
+    UdpChannel channel;
+    std::mt19937 random(3);
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t size : {1, 120, 250, 16, 600, MQTT_UDP_PACKET_CAPACITY - MQTT_UDP_HEADER_SIZE}) {
+        frames.push_back(RandomFrame(random, size));
+    }
+    size_t before = HeapAllocations();
+    for (int i = 0; i < 100; i++) {
+        for (const auto& frame : frames) {
+            DoNotOptimize(BuildPacketInPlace(channel, frame)[0]);
+        }
+    }
+    CHECK_EQ(HeapAllocations() - before, 0);
+}
+
+// A 60ms Opus frame at the default bit rate is around 120 bytes
+static void BenchmarkBuildPacket() {
+    std::mt19937 random(4);
+    for (size_t size : {120, 600}) {
+        auto frame = RandomFrame(random, size);
+        UdpChannel copying;
+        UdpChannel in_place;
+        char name[64];
+        snprintf(name, sizeof(name), "%zu byte frame, copying", size);
+        double before = Benchmark(name, 200000, [&]() {
+            DoNotOptimize(BuildPacketCopying(copying, frame)[0]);
+        });
+        snprintf(name, sizeof(name), "%zu byte frame, in place", size);
+        double after = Benchmark(name, 200000, [&]() {
+            DoNotOptimize(BuildPacketInPlace(in_place, frame)[0]);
+        });
+        printf("in place takes %.0f%% of the time for %zu bytes\n", after / before * 100, size);
+    }
+}
+
+int main() {
+    TestSameBytes();
+    TestHeaderAndRoundTrip();
+    TestNoHeap();
+    BenchmarkBuildPacket();
+    return TestResult();
+}
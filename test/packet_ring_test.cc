@@ -0,0 +1,245 @@
+#include "host_test.h"
+#include "packet_ring.h"
+
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The queue PacketRing replaced in Application, kept here as the benchmark baseline
+class ListQueue {
+public:
+    void Push(const uint8_t* data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        packets_.emplace_back(data, data + size);
+    }
+
+    bool Pop(std::vector<uint8_t>& packet) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (packets_.empty()) {
+            return false;
+        }
+        packet = std::move(packets_.front());
+        packets_.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    std::list<std::vector<uint8_t>> packets_;
+};
+
+static void TestUnallocated() {
+    PacketRing ring;
+    uint8_t packet[4] = {1, 2, 3, 4};
+    std::vector<uint8_t> out;
+    CHECK(!ring.allocated());
+    CHECK(!ring.Push(packet, sizeof(packet)));
+    CHECK(!ring.PushView(packet, sizeof(packet)));
+    CHECK(!ring.Pop(out));
+    CHECK(!ring.DropOldest());
+    CHECK(ring.Empty());
+}
+
+static void TestOrderAndCapacity() {
+    PacketRing ring(8);
+    CHECK(ring.Allocate(5));
+    CHECK_EQ(ring.capacity(), 8);
+
+    for (uint8_t i = 0; i < 8; i++) {
+        uint8_t packet[3] = {i, uint8_t(i + 1), uint8_t(i + 2)};
+        CHECK(ring.Push(packet, 1 + i % 3, 1000 + i));
+    }
+    uint8_t extra = 0;
+    CHECK(!ring.Push(&extra, 1));
+    CHECK_EQ(ring.Size(), 8);
+
+    std::vector<uint8_t> out;
+    int64_t timestamp = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        CHECK(ring.Pop(out, &timestamp));
+        CHECK_EQ(out.size(), 1 + i % 3);
+        CHECK_EQ(out[0], i);
+        CHECK_EQ(timestamp, 1000 + i);
+    }
+    CHECK(!ring.Pop(out));
+    CHECK(ring.Empty());
+}
+
+static void TestSizeLimitAndViews() {
+    PacketRing ring(16);
+    CHECK(ring.Allocate(4));
+    uint8_t large[17] = {};
+    CHECK(!ring.Push(large, sizeof(large)));
+    CHECK(!ring.PushView(large, sizeof(large)));
+
+    static const uint8_t asset[16] = {9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 1, 2, 3, 4, 5, 6};
+    CHECK(ring.PushView(asset, sizeof(asset), 7));
+    uint8_t buffer[16];
+    size_t size = 0;
+    int64_t timestamp = 0;
+    CHECK(ring.Pop(buffer, size, &timestamp));
+    CHECK_EQ(size, sizeof(asset));
+    CHECK_EQ(timestamp, 7);
+    CHECK(memcmp(buffer, asset, size) == 0);
+
+    // A views only ring has no slab, so it takes views but not copies
+    PacketRing views(16);
+    CHECK(views.Allocate(4, true));
+    CHECK(!views.Push(asset, 4));
+    CHECK(views.PushView(asset, 4));
+}
+
+static void TestDropAndClear() {
+    PacketRing ring(4);
+    CHECK(ring.Allocate(4));
+    for (uint8_t i = 0; i < 4; i++) {
+        CHECK(ring.Push(&i, 1));
+    }
+    CHECK(ring.DropOldest());
+    std::vector<uint8_t> out;
+    CHECK(ring.Pop(out));
+    CHECK_EQ(out[0], 1);
+    ring.Clear();
+    CHECK(ring.Empty());
+    // Indices keep counting past the capacity after the ring wrapped
+    for (uint8_t i = 0; i < 10; i++) {
+        CHECK(ring.Push(&i, 1));
+        CHECK(ring.Pop(out));
+        CHECK_EQ(out[0], i);
+    }
+}
+
+static void TestNoHeapAfterAllocate() {
+    PacketRing ring;
+    CHECK(ring.Allocate(16));
+    uint8_t packet[OPUS_PACKET_SLOT_SIZE] = {};
+    std::vector<uint8_t> out;
+    out.reserve(OPUS_PACKET_SLOT_SIZE);
+
+    size_t before = HeapAllocations();
+    for (int i = 0; i < 1000; i++) {
+        ring.Push(packet, 120 + i % 100);
+        ring.Push(packet, 60);
+        ring.Pop(out);
+        ring.DropOldest();
+    }
+    CHECK_EQ(HeapAllocations() - before, 0);
+}
+
+// Several producers and consumers, every packet carries its producer and a sequence number.
+// Each must come out exactly once, and a consumer must see each producer's packets in order.
+static void TestConcurrent() {
+    constexpr int kProducers = 3;
+    constexpr int kConsumers = 3;
+    constexpr uint32_t kPackets = 50000;
+    PacketRing ring(8);
+    CHECK(ring.Allocate(64));
+
+    std::vector<std::atomic<uint8_t>> seen(kProducers * kPackets);
+    std::atomic<int> producers_done{0};
+    std::atomic<bool> out_of_order{false};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < kProducers; p++) {
+        threads.emplace_back([&, p]() {
+            for (uint32_t i = 0; i < kPackets; i++) {
+                uint32_t packet[2] = {uint32_t(p), i};
+                while (!ring.Push((const uint8_t*)packet, sizeof(packet))) {
+                    std::this_thread::yield();
+                }
+            }
+            producers_done++;
+        });
+    }
+    for (int c = 0; c < kConsumers; c++) {
+        threads.emplace_back([&]() {
+            int64_t last[kProducers];
+            for (auto& value : last) {
+                value = -1;
+            }
+            uint32_t packet[2];
+            size_t size;
+            while (true) {
+                if (ring.Pop(packet, size)) {
+                    if (packet[1] <= last[packet[0]]) {
+                        out_of_order = true;
+                    }
+                    last[packet[0]] = packet[1];
+                    seen[packet[0] * kPackets + packet[1]]++;
+                } else if (producers_done == kProducers && ring.Empty()) {
+                    break;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    size_t missing = 0;
+    size_t repeated = 0;
+    for (auto& count : seen) {
+        missing += count == 0;
+        repeated += count > 1;
+    }
+    CHECK_EQ(missing, 0);
+    CHECK_EQ(repeated, 0);
+    CHECK(!out_of_order);
+}
+
+static void BenchmarkQueues() {
+    uint8_t packet[200] = {};
+    std::vector<uint8_t> out;
+    out.reserve(OPUS_PACKET_SLOT_SIZE);
+
+    PacketRing ring;
+    ring.Allocate(16);
+    double ring_ns = Benchmark("PacketRing push+pop", 1000000, [&]() {
+        ring.Push(packet, sizeof(packet));
+        ring.Pop(out);
+    });
+    ListQueue list;
+    double list_ns = Benchmark("list+mutex push+pop", 1000000, [&]() {
+        list.Push(packet, sizeof(packet));
+        list.Pop(out);
+    });
+    printf("PacketRing is %.1fx the speed of the list queue\n", list_ns / ring_ns);
+
+    // One producer and one consumer thread, as the network task and the audio loop
+    constexpr int kPackets = 200000;
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        for (int i = 0; i < kPackets; i++) {
+            while (!ring.Push(packet, sizeof(packet))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::vector<uint8_t> received;
+    received.reserve(OPUS_PACKET_SLOT_SIZE);
+    for (int i = 0; i < kPackets;) {
+        if (ring.Pop(received)) {
+            i++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    printf("benchmark %-40s %12.1f ns\n", "PacketRing across two threads", elapsed.count() / kPackets);
+}
+
+int main() {
+    TestUnallocated();
+    TestOrderAndCapacity();
+    TestSizeLimitAndViews();
+    TestDropAndClear();
+    TestNoHeapAfterAllocate();
+    TestConcurrent();
+    BenchmarkQueues();
+    return TestResult();
+}
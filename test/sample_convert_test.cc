@@ -0,0 +1,128 @@
+#include "host_test.h"
+#include "sample_convert.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+// The scalar loops NoAudioCodec had before the kernels, the kernels must match them bit for bit
+
+__attribute__((noinline)) static void ReferenceWrite(const int16_t* in, int32_t* out, size_t samples, int volume) {
+    int32_t volume_factor = pow(double(volume) / 100.0, 2) * 65536;
+    for (size_t i = 0; i < samples; i++) {
+        int64_t temp = int64_t(in[i]) * volume_factor;
+        if (temp > INT32_MAX) {
+            out[i] = INT32_MAX;
+        } else if (temp < INT32_MIN) {
+            out[i] = INT32_MIN;
+        } else {
+            out[i] = (int32_t)temp;
+        }
+    }
+}
+
+__attribute__((noinline)) static void ReferenceRead(const int32_t* in, int16_t* out, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        int32_t value = in[i] >> shift;
+        out[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    }
+}
+
+// Every 16-bit sample at every volume, including volumes above 100 that saturate
+static void TestS16ToS32Exhaustive() {
+    std::vector<int16_t> in(65536);
+    for (int i = 0; i < 65536; i++) {
+        in[i] = int16_t(i - 32768);
+    }
+    std::vector<int32_t> expected(in.size());
+    std::vector<int32_t> actual(in.size());
+    int mismatched_volumes = 0;
+    for (int volume = 0; volume <= 200; volume++) {
+        ReferenceWrite(in.data(), expected.data(), in.size(), volume);
+        ConvertS16ToS32Gain(in.data(), actual.data(), in.size(), VolumeToGainQ16(volume));
+        if (expected != actual) {
+            mismatched_volumes++;
+            fprintf(stderr, "ConvertS16ToS32Gain differs at volume %d\n", volume);
+        }
+    }
+    CHECK_EQ(mismatched_volumes, 0);
+}
+
+// Lengths around the unrolled block size, so the tail loop is covered too
+static void TestS16ToS32Tails() {
+    std::mt19937 random(1);
+    for (size_t samples = 0; samples < 12; samples++) {
+        std::vector<int16_t> in(samples);
+        for (auto& sample : in) {
+            sample = int16_t(random());
+        }
+        std::vector<int32_t> expected(samples + 1, 0x5a5a5a5a);
+        std::vector<int32_t> actual(samples + 1, 0x5a5a5a5a);
+        ReferenceWrite(in.data(), expected.data(), samples, 70);
+        ConvertS16ToS32Gain(in.data(), actual.data(), samples, VolumeToGainQ16(70));
+        // The element past the end is untouched
+        CHECK(expected == actual);
+    }
+}
+
+static void TestS32ToS16() {
+    std::mt19937 random(2);
+    std::vector<int32_t> in = {INT32_MIN, INT32_MIN + 1, -(32767 << 12) - 1, -(32767 << 12), -4096, -4095, -1, 0, 1,
+                               4095, 4096, 32767 << 12, (32767 << 12) + 4095, (32768 << 12), INT32_MAX - 1, INT32_MAX};
+    while (in.size() < 100003) {
+        // Mostly in range, some well outside it
+        int32_t value = random() % 4 == 0 ? int32_t(random()) : int32_t(random() % (1 << 28)) - (1 << 27);
+        in.push_back(value);
+    }
+    std::vector<int16_t> expected(in.size());
+    std::vector<int16_t> actual(in.size());
+    for (int shift = 0; shift <= 16; shift++) {
+        ReferenceRead(in.data(), expected.data(), in.size(), shift);
+        ConvertS32ToS16Shift(in.data(), actual.data(), in.size(), shift);
+        if (!CHECK(expected == actual)) {
+            fprintf(stderr, "  ConvertS32ToS16Shift differs with shift %d\n", shift);
+        }
+    }
+}
+
+// The kernels are written for what GCC makes of them on Xtensa, where neither version is
+// vectorized. A host compiler may vectorize both, so the ratio here does not carry over.
+static void BenchmarkConversions() {
+    constexpr size_t kSamples = 480;
+    // Read at run time, as the codec's volume is, so the gain is not folded into the loop
+    volatile int volume = 70;
+    std::vector<int16_t> pcm(kSamples);
+    std::vector<int32_t> wide(kSamples);
+    for (size_t i = 0; i < kSamples; i++) {
+        pcm[i] = int16_t(i * 97);
+        wide[i] = int32_t(i * 977777);
+    }
+
+    double reference = Benchmark("write 480 samples, scalar reference", 200000, [&]() {
+        ReferenceWrite(pcm.data(), wide.data(), kSamples, volume);
+        DoNotOptimize(wide[0]);
+    });
+    double kernel = Benchmark("write 480 samples, ConvertS16ToS32Gain", 200000, [&]() {
+        ConvertS16ToS32Gain(pcm.data(), wide.data(), kSamples, VolumeToGainQ16(volume));
+        DoNotOptimize(wide[0]);
+    });
+    printf("ConvertS16ToS32Gain is %.1fx the speed of the reference\n", reference / kernel);
+
+    reference = Benchmark("read 480 samples, scalar reference", 200000, [&]() {
+        ReferenceRead(wide.data(), pcm.data(), kSamples, 12);
+        DoNotOptimize(pcm[0]);
+    });
+    kernel = Benchmark("read 480 samples, ConvertS32ToS16Shift", 200000, [&]() {
+        ConvertS32ToS16Shift(wide.data(), pcm.data(), kSamples, 12);
+        DoNotOptimize(pcm[0]);
+    });
+    printf("ConvertS32ToS16Shift is %.1fx the speed of the reference\n", reference / kernel);
+}
+
+int main() {
+    TestS16ToS32Exhaustive();
+    TestS16ToS32Tails();
+    TestS32ToS16();
+    BenchmarkConversions();
+    return TestResult();
+}
@@ -0,0 +1,33 @@
+#ifndef _AUDIO_CODEC_H
+#define _AUDIO_CODEC_H
+
+// Host stand-in for main/audio_codecs/audio_codec.h without the I2S driver.
+// Tests derive from it and set the protected members like a board codec does.
+
+#include <cstdint>
+#include <vector>
+
+class AudioCodec {
+public:
+    virtual ~AudioCodec() = default;
+
+    bool InputData(std::vector<int16_t>& data) {
+        int samples = Read(data.data(), data.size());
+        return samples > 0;
+    }
+
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+    inline int input_channels() const { return input_channels_; }
+    inline int output_channels() const { return output_channels_; }
+
+protected:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int input_channels_ = 1;
+    int output_channels_ = 1;
+
+    virtual int Read(int16_t* dest, int samples) = 0;
+};
+
+#endif // _AUDIO_CODEC_H
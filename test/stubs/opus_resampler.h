@@ -0,0 +1,36 @@
+#ifndef OPUS_RESAMPLER_H
+#define OPUS_RESAMPLER_H
+
+// Host stand-in for the OpusResampler of esp-opus-encoder, the fallback of AudioResampler
+// for ratios without a specialized kernel. It picks the nearest sample and is only good
+// enough to keep the fallback path running, tests measure the specialized kernels.
+
+#include <cstdint>
+
+class OpusResampler {
+public:
+    void Configure(int input_sample_rate, int output_sample_rate) {
+        input_sample_rate_ = input_sample_rate;
+        output_sample_rate_ = output_sample_rate;
+    }
+
+    void Process(const int16_t* input, int input_samples, int16_t* output) {
+        int output_samples = GetOutputSamples(input_samples);
+        for (int i = 0; i < output_samples; i++) {
+            output[i] = input[int64_t(i) * input_sample_rate_ / output_sample_rate_];
+        }
+    }
+
+    int GetOutputSamples(int input_samples) const {
+        return int64_t(input_samples) * output_sample_rate_ / input_sample_rate_;
+    }
+
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+};
+
+#endif // OPUS_RESAMPLER_H
@@ -0,0 +1,93 @@
+#include "host_test.h"
+
+#include <esp_heap_caps.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static int failures = 0;
+static int checks = 0;
+static std::atomic<size_t> heap_allocations{0};
+
+bool HostTestCheck(bool passed, const char* expression, const char* file, int line) {
+    checks++;
+    if (!passed) {
+        failures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    }
+    return passed;
+}
+
+bool HostTestCheckEqual(long long actual, long long expected, const char* expression, const char* file, int line) {
+    checks++;
+    if (actual != expected) {
+        failures++;
+        fprintf(stderr, "%s:%d: check failed: %s is %lld, expected %lld\n", file, line, expression, actual, expected);
+        return false;
+    }
+    return true;
+}
+
+int TestResult() {
+    printf("%d of %d checks failed\n", failures, checks);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+size_t HeapAllocations() {
+    return heap_allocations.load();
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    heap_allocations++;
+    return malloc(size);
+}
+
+void* heap_caps_calloc(size_t count, size_t size, uint32_t caps) {
+    heap_allocations++;
+    return calloc(count, size);
+}
+
+void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+// Every C++ allocation of the test goes through these, so a hot path that should not
+// touch the heap can be checked by comparing HeapAllocations() around it
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    heap_allocations++;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
@@ -0,0 +1,49 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+// Checks and benchmarks for the host tests, just enough not to need a framework.
+// A failed check is reported and counted, the test goes on. main() returns TestResult().
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#define CHECK(condition) HostTestCheck((condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQ(actual, expected) \
+    HostTestCheckEqual((long long)(actual), (long long)(expected), #actual, __FILE__, __LINE__)
+
+bool HostTestCheck(bool passed, const char* expression, const char* file, int line);
+bool HostTestCheckEqual(long long actual, long long expected, const char* expression, const char* file, int line);
+
+// Prints the number of failed checks, returns the exit code for main()
+int TestResult();
+
+// Heap allocations made through operator new, malloc is not counted, and heap_caps_*
+// since the program started, on all threads
+size_t HeapAllocations();
+
+// Runs `body` `iterations` times after a short warm up, prints and returns the time
+// per iteration in nanoseconds. Numbers are for comparing two versions on one machine.
+template <typename Body>
+double Benchmark(const char* name, long iterations, Body body) {
+    for (long i = 0; i < iterations / 10 + 1; i++) {
+        body();
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        body();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    double per_iteration = elapsed.count() / iterations;
+    printf("benchmark %-40s %12.1f ns\n", name, per_iteration);
+    return per_iteration;
+}
+
+// Keeps the compiler from optimizing away a result that is otherwise unused
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif // HOST_TEST_H